@@ -0,0 +1,148 @@
+/*
+ *   Copyright (c) 2025 Roi
+
+ *   Digital vibrance calibration curves and their lookup tables.
+
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "dvcurve.h"
+
+/* Parse a curve description:
+        NULL or "linear"        - straight line over the monitor's range
+        "gamma=<g>"             - percentage raised to the power of g
+        "<in>:<out>,..."        - piecewise linear points, both in percentages
+
+    Returns 0 on success and -1 if @str is malformed.
+*/
+int dv_curve_parse(const char *str, dv_curve_t *curve)
+{
+    const char *p;
+    int in, out, n;
+
+    memset(curve, 0, sizeof(*curve));
+    curve->type = DV_CURVE_LINEAR;
+
+    if (str == NULL || *str == '\0' || !strcmp(str, "linear"))
+        return 0;
+
+    if (!strncmp(str, "gamma=", 6)) {
+        curve->gamma = strtod(str + 6, NULL);
+        if (!(curve->gamma > 0.0))
+            return -1;
+        curve->type = DV_CURVE_GAMMA;
+        return 0;
+    }
+
+    for (p = str; *p; p += n) {
+        if (curve->npoints == DV_CURVE_MAX_POINTS)
+            return -1;
+        if (sscanf(p, "%d:%d%n", &in, &out, &n) != 2)
+            return -1;
+        if (in < 0 || in > 100 || out < 0 || out > 100)
+            return -1;
+        if (curve->npoints && in <= curve->points[curve->npoints - 1].in)
+            return -1;
+
+        curve->points[curve->npoints].in = in;
+        curve->points[curve->npoints].out = out;
+        curve->npoints++;
+
+        if (p[n] == ',')
+            n++;
+        else if (p[n] != '\0')
+            return -1;
+    }
+
+    if (curve->npoints == 0)
+        return -1;
+    curve->type = DV_CURVE_POINTS;
+
+    return 0;
+}
+
+/* Evaluate @curve for percentage @x, result is in [0, 1] */
+static double dv_curve_eval(const dv_curve_t *curve, int x)
+{
+    int i;
+
+    switch (curve->type) {
+    case DV_CURVE_GAMMA:
+        return pow(x / 100.0, curve->gamma);
+    case DV_CURVE_POINTS:
+        if (x <= curve->points[0].in)
+            return curve->points[0].out / 100.0;
+        for (i = 1; i < curve->npoints; i++) {
+            if (x <= curve->points[i].in)
+                return (curve->points[i - 1].out +
+                        (double)(x - curve->points[i - 1].in) *
+                        (curve->points[i].out - curve->points[i - 1].out) /
+                        (curve->points[i].in - curve->points[i - 1].in)) / 100.0;
+        }
+        return curve->points[curve->npoints - 1].out / 100.0;
+    default:
+        return x / 100.0;
+    }
+}
+
+/* Build both conversion tables of @lut for the range [@min, @max].
+    Non monotonic curves are flattened so the reverse table stays well defined.
+
+    Returns 0 on success, -1 on a bad range or allocation failure.
+*/
+int dv_lut_build(dv_lut_t *lut, int64_t min, int64_t max, const dv_curve_t *curve)
+{
+    dv_curve_t linear = { .type = DV_CURVE_LINEAR };
+    int64_t v, range;
+    int p;
+
+    if (max <= min || max - min >= DV_LUT_MAX_RANGE)
+        return -1;
+    if (curve == NULL)
+        curve = &linear;
+
+    range = max - min;
+    lut->to_percentage = realloc(lut->to_percentage, range + 1);
+    if (lut->to_percentage == NULL)
+        return -1;
+    lut->min = min;
+    lut->max = max;
+
+    for (p = 0; p < DV_LUT_STEPS; p++) {
+        lut->to_value[p] = min + llround(dv_curve_eval(curve, p) * range);
+        if (p && lut->to_value[p] < lut->to_value[p - 1])
+            lut->to_value[p] = lut->to_value[p - 1];
+    }
+
+    /* Every value maps to the highest percentage not above it, so
+        to_percentage[to_value[p]] == p whenever the curve is injective */
+    for (v = min, p = 0; v <= max; v++) {
+        while (p + 1 < DV_LUT_STEPS && lut->to_value[p + 1] <= v)
+            p++;
+        lut->to_percentage[v - min] = p;
+    }
+
+    return 0;
+}
+
+void dv_lut_free(dv_lut_t *lut)
+{
+    free(lut->to_percentage);
+    lut->to_percentage = NULL;
+}
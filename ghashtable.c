@@ -15,61 +15,481 @@
  *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
 #include "ghashtable.h"
 #include "vibrancelui.h"
 
-GHashTable *ht;
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open      434 /* Same number on every architecture */
+#endif
+
+#define MAX_REAPED_PER_WAKEUP   16
+
+/* A pidfd event names both the process and the pidfd watching it */
+#define PIDFD_EV_DATA(pid, pidfd)   (((uint64_t)(pid) << 32) | (uint32_t)(pidfd))
+#define PIDFD_EV_PID(data)          ((unsigned long)((data) >> 32))
+#define PIDFD_EV_FD(data)           ((int)(uint32_t)(data))
 
-void glib_new_hash_table()
+/* Value stored for every Process ID key */
+typedef struct pid_rule {
+    display_settings_t settings; /* Vibrance as a percentage */
+    int pidfd; /* -1 when pidfd_open(2) isn't supported by the kernel */
+} pid_rule_t;
+
+static void pid_rule_free(gpointer data)
 {
-    ht = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    pid_rule_t *rule = data;
+
+    /* Closing the pidfd also drops it from the table's epoll set */
+    if (rule->pidfd >= 0)
+        close(rule->pidfd);
+    g_free(rule);
+}
+
+static void window_rule_free(gpointer data)
+{
+    window_rule_t *rule = data;
+
+    g_pattern_spec_free(rule->pattern);
+    g_free(rule);
+}
+
+/* Key of every attribute in a rule's settings */
+static const char *rule_setting_keys[DATTR_COUNT] = {
+    [DATTR_DIGITAL_VIBRANCE] = "vibrance",
+    [DATTR_IMAGE_SHARPENING] = "sharpening",
+    [DATTR_COLOR_RANGE] = "color_range",
+    [DATTR_COLOR_SPACE] = "color_space",
+};
+
+/* Parse the decimal number in the first @len characters of @str */
+static gboolean parse_rule_value(const char *str, size_t len, int *value)
+{
+    char buf[16], *end;
+
+    if (len == 0 || len >= sizeof(buf))
+        return false;
+
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    *value = strtol(buf, &end, 10);
+
+    return *end == '\0';
+}
+
+/*  Parse what a rule applies: a list of <attribute>=<value> pairs, e.g.
+        vibrance=80,sharpening=128,color_range=1
+    or, if @bare_level, a lone vibrance percentage. Vibrance is always
+    a percentage, the other attributes are raw driver values. */
+static gboolean parse_rule_settings(const char *spec, gboolean bare_level,
+                        display_settings_t *settings)
+{
+    const char *item, *next, *eq;
+    int attr;
+
+    memset(settings, 0, sizeof(*settings));
+    if (bare_level && parse_rule_value(spec, strlen(spec),
+                &settings->value[DATTR_DIGITAL_VIBRANCE])) {
+        settings->mask = 1U << DATTR_DIGITAL_VIBRANCE;
+        return true;
+    }
+
+    for (item = spec; ; item = next + 1) {
+        next = strchr(item, ',');
+        if (next == NULL)
+            next = item + strlen(item);
+        eq = memchr(item, '=', next - item);
+        if (eq == NULL)
+            return false;
+
+        for (attr = 0; attr < DATTR_COUNT; attr++) {
+            if (strlen(rule_setting_keys[attr]) == (size_t)(eq - item) &&
+                    !strncmp(item, rule_setting_keys[attr], eq - item))
+                break;
+        }
+        if (attr == DATTR_COUNT ||
+                !parse_rule_value(eq + 1, next - eq - 1, &settings->value[attr]))
+            return false;
+        settings->mask |= 1U << attr;
+
+        if (*next == '\0')
+            return true;
+    }
+}
+
+/* Allocate an empty rule table; every X display has its own */
+rule_table_t *glib_new_hash_table()
+{
+    rule_table_t *rules = g_new0(rule_table_t, 1);
+
+    rules->ht = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, pid_rule_free);
+    rules->window_rules = g_ptr_array_new_with_free_func(window_rule_free);
+    rules->window_cache = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_mutex_init(&rules->lock);
+    rules->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (rules->epfd < 0)
+        DEBUG_PRINTF("epoll_create1 failed, exited processes won't be evicted\n");
+
+    return rules;
+}
+
+void glib_free_hash_table(rule_table_t *rules)
+{
+    if (!rules)
+        return;
+
+    g_hash_table_destroy(rules->ht);
+    g_ptr_array_unref(rules->window_rules);
+    g_hash_table_destroy(rules->window_cache);
+    g_mutex_clear(&rules->lock);
+    if (rules->epfd >= 0)
+        close(rules->epfd);
+    g_free(rules);
 }
 
 /*  Add key and value to GHashTable _or_ replace (if `key` already exists)
-    Returns false if key wasn't already in the table, and true if it was.
+    @spec is a vibrance percentage or a list of settings, see parse_rule_settings().
+    Returns false if @spec is malformed, or if the process doesn't exist
+    or can't be watched.
 
-    NOTE: This function duplicates a string and allocates memory for it.
+    Each rule keeps a pidfd of its process so the entry can be evicted
+    as soon as the process exits, before the PID gets recycled.
 */
-gboolean glib_insert_new_value(char *spid, char *vlevel)
+gboolean glib_insert_new_value(rule_table_t *rules, char *spid, char *spec)
 {
-    if (!ht || !spid || !vlevel)
+    struct epoll_event ev = { .events = EPOLLIN };
+    char key[21 + 1];
+    pid_rule_t *rule;
+    unsigned long pid;
+
+    if (!rules || !spid || !spec)
+        return false;
+
+    pid = strtoul(spid, (char **)NULL, 10);
+    if (pid == 0)
+        return false;
+
+    rule = g_new(pid_rule_t, 1);
+    if (!parse_rule_settings(spec, true, &rule->settings)) {
+        g_free(rule);
+        return false;
+    }
+    rule->pidfd = syscall(SYS_pidfd_open, (pid_t)pid, 0);
+    if (rule->pidfd < 0 && errno != ENOSYS) {
+        g_free(rule); /* No such process (or no permission to watch it) */
         return false;
+    }
+
+    if (rule->pidfd >= 0 && rules->epfd >= 0) {
+        ev.data.u64 = PIDFD_EV_DATA(pid, rule->pidfd);
+        epoll_ctl(rules->epfd, EPOLL_CTL_ADD, rule->pidfd, &ev);
+    }
+
+    /* Normalize the key so it matches what the hook formats from _NET_WM_PID */
+    snprintf(key, sizeof(key), "%lu", pid);
+
+    g_mutex_lock(&rules->lock);
+    g_hash_table_insert(rules->ht, g_strdup(key), rule);
+    g_mutex_unlock(&rules->lock);
 
-    return g_hash_table_insert(ht, g_strdup(spid), g_strdup(vlevel));
+    return true;
 }
 
-/* Fetch the Vibrance level for the given Process ID `spid` */
-const char *fetch_vlevel_for_spid_ht(char *spid)
+/* Copy the settings of the rule for the given Process ID `spid`
+    into @settings. Returns false if spid isn't present. */
+gboolean fetch_settings_for_spid_ht(rule_table_t *rules, const char *spid,
+                        display_settings_t *settings)
 {
-    return g_hash_table_lookup(ht, spid); /* NULL if spid isn't present. */
+    pid_rule_t *rule;
+
+    /* Copied under the lock, the GUI may replace the rule meanwhile */
+    g_mutex_lock(&rules->lock);
+    rule = g_hash_table_lookup(rules->ht, spid);
+    if (rule)
+        *settings = rule->settings;
+    g_mutex_unlock(&rules->lock);
+
+    return rule != NULL;
+}
+
+/* File descriptor the hook's event loop polls to learn about exited processes */
+int glib_rules_pollfd(rule_table_t *rules)
+{
+    return rules->epfd;
+}
+
+/* Has the process watched by @pidfd exited? Its pidfd turns readable */
+static gboolean pidfd_exited(int pidfd)
+{
+    struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+/* Evict the rules of every process that exited since the last call.
+    The GUI may have replaced a rule since the event was queued (its PID
+    recycled by a new process), so only the rule still watched by the
+    pidfd that fired goes, and only if its process is really gone.
+    Returns the number of evicted rules. */
+guint glib_reap_exited_pids(rule_table_t *rules)
+{
+    struct epoll_event evs[MAX_REAPED_PER_WAKEUP];
+    char key[21 + 1];
+    pid_rule_t *rule;
+    int i, n;
+    guint reaped = 0;
+
+    n = epoll_wait(rules->epfd, evs, MAX_REAPED_PER_WAKEUP, 0);
+    if (n <= 0)
+        return 0;
+
+    g_mutex_lock(&rules->lock);
+    for (i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "%lu", PIDFD_EV_PID(evs[i].data.u64));
+        rule = g_hash_table_lookup(rules->ht, key);
+        if (rule == NULL || rule->pidfd != PIDFD_EV_FD(evs[i].data.u64) ||
+                !pidfd_exited(rule->pidfd))
+            continue;
+        g_hash_table_remove(rules->ht, key);
+        reaped++;
+    }
+    g_mutex_unlock(&rules->lock);
+
+    g_atomic_int_add(&rules->evictions, reaped);
+    DEBUG_PRINTF("Evicted %u rule(s) of exited processes (%u total)\n",
+        reaped, glib_pid_evictions(rules));
+
+    return reaped;
+}
+
+/* Number of rules evicted since launch because their process exited */
+guint glib_pid_evictions(rule_table_t *rules)
+{
+    return g_atomic_int_get(&rules->evictions);
 }
 
 /* Remove all keys and values off the table */
-__always_inline void glib_clear_hash_table()
+void glib_clear_hash_table(rule_table_t *rules)
+{
+    g_mutex_lock(&rules->lock);
+    g_hash_table_remove_all(rules->ht);
+    g_mutex_unlock(&rules->lock);
+}
+
+/*  Add a window rule described by @spec, one of
+        class:<instance>=<settings>
+        title:<glob>=<settings>
+        role:<role>=<settings>
+    where <settings> is the same as for a Process ID rule.
+    Returns false if @spec is malformed.
+*/
+gboolean glib_insert_window_rule(rule_table_t *rules, const char *spec)
+{
+    static const char *prefixes[] = {
+        [WINDOW_RULE_CLASS] = "class:",
+        [WINDOW_RULE_TITLE] = "title:",
+        [WINDOW_RULE_ROLE] = "role:",
+    };
+    display_settings_t settings;
+    window_rule_t *rule;
+    const char *sep;
+    char *pattern;
+    guint match;
+
+    if (!rules || !spec)
+        return false;
+
+    for (match = 0; match < G_N_ELEMENTS(prefixes); match++) {
+        if (!strncmp(spec, prefixes[match], strlen(prefixes[match])))
+            break;
+    }
+    if (match == G_N_ELEMENTS(prefixes))
+        return false;
+
+    /* A list of settings follows the first '=' it can, a bare level follows
+        the last '=', so patterns may contain one */
+    spec += strlen(prefixes[match]);
+    for (sep = strchr(spec, '='); sep; sep = strchr(sep + 1, '=')) {
+        if (sep != spec && parse_rule_settings(sep + 1, false, &settings))
+            break;
+    }
+    if (sep == NULL) {
+        sep = strrchr(spec, '=');
+        if (sep == NULL || sep == spec || !parse_rule_settings(sep + 1, true, &settings))
+            return false;
+    }
+
+    pattern = g_strndup(spec, sep - spec);
+    rule = g_new(window_rule_t, 1);
+    rule->match = match;
+    rule->pattern = g_pattern_spec_new(pattern);
+    rule->settings = settings;
+    g_free(pattern);
+
+    g_mutex_lock(&rules->lock);
+    g_ptr_array_add(rules->window_rules, rule);
+    g_hash_table_remove_all(rules->window_cache); /* Resolved with the old rules */
+    g_mutex_unlock(&rules->lock);
+
+    return true;
+}
+
+guint glib_window_rules_count(rule_table_t *rules)
+{
+    return rules->window_rules->len;
+}
+
+/* Resolve the rule of a window from its properties, any of which may be
+    NULL. Returns NULL if no window rule matches. Rules are only freed
+    along with the table, so the result stays valid. */
+const window_rule_t *glib_match_window_rule(rule_table_t *rules, const char *instance,
+                        const char *title, const char *role)
+{
+    const char *subjects[] = {
+        [WINDOW_RULE_CLASS] = instance,
+        [WINDOW_RULE_TITLE] = title,
+        [WINDOW_RULE_ROLE] = role,
+    };
+    window_rule_t *rule, *matched = NULL;
+    guint i;
+
+    g_mutex_lock(&rules->lock);
+    for (i = 0; i < rules->window_rules->len; i++) {
+        rule = g_ptr_array_index(rules->window_rules, i);
+        if (subjects[rule->match] &&
+                g_pattern_spec_match_string(rule->pattern, subjects[rule->match])) {
+            matched = rule;
+            break;
+        }
+    }
+    g_mutex_unlock(&rules->lock);
+
+    return matched;
+}
+
+/* Fetch the rule @window resolved to, if it was resolved already */
+gboolean glib_window_cache_lookup(rule_table_t *rules, gulong window,
+                        const window_rule_t **rule)
 {
-    return g_hash_table_remove_all(ht);
+    gpointer value;
+    gboolean found;
+
+    g_mutex_lock(&rules->lock);
+    found = g_hash_table_lookup_extended(rules->window_cache,
+                GSIZE_TO_POINTER(window), NULL, &value);
+    g_mutex_unlock(&rules->lock);
+
+    if (found)
+        *rule = value;
+    return found;
+}
+
+void glib_window_cache_store(rule_table_t *rules, gulong window,
+                        const window_rule_t *rule)
+{
+    g_mutex_lock(&rules->lock);
+    g_hash_table_insert(rules->window_cache, GSIZE_TO_POINTER(window),
+                (gpointer)rule);
+    g_mutex_unlock(&rules->lock);
+}
+
+/* Forget what @window resolved to, after one of its matched properties
+    changed or it was destroyed. Returns true if it was cached. */
+gboolean glib_window_cache_invalidate(rule_table_t *rules, gulong window)
+{
+    gboolean removed;
+
+    g_mutex_lock(&rules->lock);
+    removed = g_hash_table_remove(rules->window_cache, GSIZE_TO_POINTER(window));
+    g_mutex_unlock(&rules->lock);
+
+    return removed;
+}
+
+/* Window list of glib_window_cache_retain() */
+struct window_list {
+    const gulong *windows;
+    gulong nwindows;
+};
+
+static gboolean window_not_listed(gpointer key, gpointer value, gpointer data)
+{
+    const struct window_list *list = data;
+    gulong i;
+
+    for (i = 0; i < list->nwindows; i++) {
+        if (list->windows[i] == GPOINTER_TO_SIZE(key))
+            return false;
+    }
+    return true;
+}
+
+/* Forget every window but the @nwindows @windows, i.e. those that were
+    destroyed. Returns the number of windows forgotten. */
+guint glib_window_cache_retain(rule_table_t *rules, const gulong *windows, gulong nwindows)
+{
+    struct window_list list = { windows, nwindows };
+    guint removed;
+
+    g_mutex_lock(&rules->lock);
+    removed = g_hash_table_foreach_remove(rules->window_cache, window_not_listed, &list);
+    g_mutex_unlock(&rules->lock);
+
+    return removed;
+}
+
+/* Can a change of title or role change what a window resolved to?
+    Only if a title or role rule comes first or is the one that matched;
+    with no match (@matched NULL) any title or role rule could match later. */
+gboolean glib_window_rule_depends_on_title(rule_table_t *rules, const window_rule_t *matched)
+{
+    window_rule_t *rule;
+    gboolean depends = false;
+    guint i;
+
+    g_mutex_lock(&rules->lock);
+    for (i = 0; i < rules->window_rules->len; i++) {
+        rule = g_ptr_array_index(rules->window_rules, i);
+        if (rule->match != WINDOW_RULE_CLASS) {
+            depends = true;
+            break;
+        }
+        if (rule == matched)
+            break;
+    }
+    g_mutex_unlock(&rules->lock);
+
+    return depends;
 }
 
 /* Return the number of elements contained in the GHashTable, i.e.
     Number of processes tracked. */
-static __always_inline guint glib_pids_in_ht()
+static __always_inline guint glib_pids_in_ht(rule_table_t *rules)
 {
-    return g_hash_table_size(ht);
+    return g_hash_table_size(rules->ht);
 }
 
 #ifdef DEBUG
 void ghfunc_callback(gpointer key,
     gpointer value, gpointer user_data)
 {
-    guint total_pairs_in_ht = glib_pids_in_ht();
-    DEBUG_PRINTF("PAIRS TOTAL - %u : KEY - %s ; VALUE - %s\n",
-        total_pairs_in_ht, (char *)key, (char *)value);
+    guint total_pairs_in_ht = glib_pids_in_ht(user_data);
+    pid_rule_t *rule = value;
+
+    DEBUG_PRINTF("PAIRS TOTAL - %u : KEY - %s ; MASK - %#x ; PIDFD - %d\n",
+        total_pairs_in_ht, (char *)key, rule->settings.mask, rule->pidfd);
 }
 
-void print_table_contents()
+void print_table_contents(rule_table_t *rules)
 {
-    g_hash_table_foreach(ht, ghfunc_callback, NULL);
+    g_mutex_lock(&rules->lock);
+    g_hash_table_foreach(rules->ht, ghfunc_callback, rules);
+    g_mutex_unlock(&rules->lock);
 }
 #endif
-
-
@@ -0,0 +1,74 @@
+/*
+ *   Copyright (c) 2025 Roi
+
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DVCURVE_H
+#define DVCURVE_H
+
+#include <stdint.h>
+
+#define DV_LUT_STEPS            101 /* 0% .. 100% */
+#define DV_LUT_MAX_RANGE        65536 /* Refuse absurd driver ranges */
+#define DV_CURVE_MAX_POINTS     16
+
+enum dv_curve_type {
+    DV_CURVE_LINEAR,
+    DV_CURVE_GAMMA,
+    DV_CURVE_POINTS,
+};
+
+/* User defined mapping of the slider percentage to the driver range */
+typedef struct dv_curve {
+    enum dv_curve_type type;
+    double gamma;
+    int npoints;
+    struct {
+        int in, out; /* Both percentages, @in strictly ascending */
+    } points[DV_CURVE_MAX_POINTS];
+} dv_curve_t;
+
+/* Precomputed conversion tables of one monitor */
+typedef struct dv_lut {
+    int64_t min, max;
+    int to_value[DV_LUT_STEPS];
+    unsigned char *to_percentage; /* (max - min + 1) entries */
+} dv_lut_t;
+
+int dv_curve_parse(const char *, dv_curve_t *);
+int dv_lut_build(dv_lut_t *, int64_t, int64_t, const dv_curve_t *);
+void dv_lut_free(dv_lut_t *);
+
+static inline int
+dv_lut_to_value(const dv_lut_t *lut, int percentage)
+{
+    if (percentage < 0)
+        percentage = 0;
+    else if (percentage > 100)
+        percentage = 100;
+    return lut->to_value[percentage];
+}
+
+static inline int
+dv_lut_to_percentage(const dv_lut_t *lut, int value)
+{
+    if (value < lut->min)
+        value = lut->min;
+    else if (value > lut->max)
+        value = lut->max;
+    return lut->to_percentage[value - lut->min];
+}
+
+#endif /* DVCURVE_H */
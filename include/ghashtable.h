@@ -21,14 +21,54 @@
 
 #include <glib.h>
 
-extern GHashTable *ht;
+#include "vprofile.h"
 
-void glib_new_hash_table();
-gboolean glib_insert_new_value(char *, char *);
-const char *fetch_vlevel_for_spid_ht(char *);
+/* What a window rule is matched against */
+enum window_rule_match {
+    WINDOW_RULE_CLASS, /* WM_CLASS instance name */
+    WINDOW_RULE_TITLE, /* _NET_WM_NAME, or WM_NAME */
+    WINDOW_RULE_ROLE, /* WM_WINDOW_ROLE */
+};
+
+/* Rule scoped to windows rather than to a whole process */
+typedef struct window_rule {
+    enum window_rule_match match;
+    GPatternSpec *pattern; /* Shell-style glob */
+    display_settings_t settings; /* Vibrance as a percentage */
+} window_rule_t;
+
+/* Per X display table of Process ID and window rules */
+typedef struct rule_table {
+    GHashTable *ht;
+    GMutex lock; /* GUI thread inserts while the hook thread reads\evicts */
+    int epfd; /* pidfds of the tracked processes */
+    guint evictions;
+    GPtrArray *window_rules; /* window_rule_t, first match wins */
+    GHashTable *window_cache; /* Window -> matched window_rule_t, NULL if none */
+} rule_table_t;
+
+rule_table_t *glib_new_hash_table();
+void glib_free_hash_table(rule_table_t *);
+gboolean glib_insert_new_value(rule_table_t *, char *, char *);
+gboolean fetch_settings_for_spid_ht(rule_table_t *, const char *,
+                        display_settings_t *);
+int glib_rules_pollfd(rule_table_t *);
+guint glib_reap_exited_pids(rule_table_t *);
+guint glib_pid_evictions(rule_table_t *);
+void glib_clear_hash_table(rule_table_t *);
+
+gboolean glib_insert_window_rule(rule_table_t *, const char *);
+guint glib_window_rules_count(rule_table_t *);
+const window_rule_t *glib_match_window_rule(rule_table_t *, const char *,
+                        const char *, const char *);
+gboolean glib_window_cache_lookup(rule_table_t *, gulong, const window_rule_t **);
+void glib_window_cache_store(rule_table_t *, gulong, const window_rule_t *);
+gboolean glib_window_cache_invalidate(rule_table_t *, gulong);
+guint glib_window_cache_retain(rule_table_t *, const gulong *, gulong);
+gboolean glib_window_rule_depends_on_title(rule_table_t *, const window_rule_t *);
 
 #ifdef DEBUG
-void print_table_contents();
+void print_table_contents(rule_table_t *);
 #endif /* DEBUG */
 
 #endif /* GHASHTABLE_H */
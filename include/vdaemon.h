@@ -0,0 +1,38 @@
+/*
+ *   Copyright (c) 2025 Roi
+
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VDAEMON_H
+#define VDAEMON_H
+
+#define MAX_DAEMON_DISPLAYS     16
+#define MAX_DAEMON_RULES        64
+#define MAX_DAEMON_EVENTS       32
+
+/* What an epoll event of the daemon refers to */
+enum daemon_fd_kind {
+    DAEMON_FD_X,
+    DAEMON_FD_RULES,
+    DAEMON_FD_SIGNAL, /* Not tied to a display, index is unused */
+};
+
+#define DAEMON_EV_DATA(index, kind)     (((uint64_t)(index) << 2) | (kind))
+#define DAEMON_EV_INDEX(data)           ((data) >> 2)
+#define DAEMON_EV_KIND(data)            ((data) & 3)
+
+int vib_daemon_main(int, char **);
+
+#endif /* VDAEMON_H */
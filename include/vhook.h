@@ -21,6 +21,19 @@
 
 #define MAXSTR      1000
 
+enum hook_poll_fds {
+    HOOK_POLL_X,
+    HOOK_POLL_RULES,
+    HOOK_POLL_WAKE, /* @gdisplay.wakefd */
+    HOOK_POLL_COUNT,
+};
+
+#include "vibrancelui.h"
+
+void vhook_install_error_handler(void);
+void vhook_display_init(global_display_t *);
+void vhook_wake(global_display_t *);
+void vhook_dispatch_pending(global_display_t *);
 void *vib_app_hook_thread_start(void *);
 
 #endif /* VHOOK_H */
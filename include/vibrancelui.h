@@ -18,11 +18,15 @@
 #ifndef VIBRANCELUI_H
 #define VIBRANCELUI_H
 
+#include <limits.h>
 #include <gtk/gtk.h>
 #include <NVCtrl/NVCtrl.h>
 #include <NVCtrl/NVCtrlLib.h>
 
 #include "vgui.h"
+#include "dvcurve.h"
+#include "vprofile.h"
+#include "ghashtable.h"
 
 #define DEFAULT_DP_VIBRANCE_LEVEL           0
 #define DEFAULT_MAX_VIBRANCE_LEVEL          1023
@@ -37,20 +41,68 @@
 #   define DEBUG_PRINTF(fmt, args...)
 #endif
 
+/* Valid values the driver reported for one attribute of a display */
+typedef struct attr_valid_values {
+    int type; /* ATTRIBUTE_TYPE_*, 0 if the display doesn't support it */
+    int64_t min, max; /* ATTRIBUTE_TYPE_RANGE */
+    unsigned int bits; /* ATTRIBUTE_TYPE_INT_BITS */
+} attr_valid_values_t;
+
 typedef struct per_monitor_settings {
-    int vibrance_level;
+    int vibrance_level; /* User's baseline: read on launch, then set by the slider.
+                        Restored when leaving an app a rule applied to */
     int width, height;
     int64_t max_vibrance,
             min_vibrance;
     int dpyId;
+    int screen; /* Index in @gdisplay.screens */
+    attr_valid_values_t valid[DATTR_COUNT];
+    int attr_cache[DATTR_COUNT]; /* Last value written to\read from the driver,
+                                    or ATTR_VALUE_UNKNOWN */
+    int attr_baseline[DATTR_COUNT]; /* Read on launch, restored when no rule sets the attribute */
+    dv_lut_t lut; /* Built from [min_vibrance, max_vibrance] */
 } monitor_config_t;
 
+/* Not a value any attribute takes, so the next apply writes it */
+#define ATTR_VALUE_UNKNOWN      INT_MIN
+
+/* Per-game profile: a set of attributes for every display */
+typedef struct display_profile {
+    int ndisplays;
+    display_settings_t *mon; /* Indexed like @monitors_conf */
+} display_profile_t;
+
+/* Empty profile for @n displays, on the caller's stack so that
+    switching profiles doesn't allocate */
+#define DISPLAY_PROFILE(n) { .ndisplays = (n),                                   \
+        .mon = memset(g_alloca((n) * sizeof(display_settings_t)), 0,             \
+                    (n) * sizeof(display_settings_t)) }
+
+/* NVIDIA X screen and the displays enabled on it */
+typedef struct nv_screen {
+    int screen; /* X screen number */
+    Window root;
+    Window active_window; /* Last focused window on this screen */
+    monitor_config_t *monitors_conf; /* Slice of @gdisplay.monitors_conf */
+    int *data; /* array taken from XNVCTRLQueryTargetBinaryData */
+    int ndisplays;
+} nv_screen_t;
+
+/* Everything tied to one X display connection. The GUI drives @gdisplay,
+    the daemon keeps one of these per served display. */
 typedef struct global_display {
     pthread_spinlock_t lock;
     Display *dpy;
-    monitor_config_t *monitors_conf;
-    int *data; /* array taken from XNVCTRLQueryTargetBinaryData */
+    monitor_config_t *monitors_conf; /* Displays of all screens */
     int ndisplays; /* "Screen" by X11's defintion is different. */
+    nv_screen_t *screens;
+    int nscreens;
+    rule_table_t *rules;
+    Atom net_active_window;
+    Atom net_wm_name, wm_window_role; /* Matched on by window rules */
+    Atom net_client_list; /* Changes when windows come and go */
+    bool connection_lost; /* Xlib reported an IO error, @dpy is unusable */
+    int wakefd; /* eventfd waking the GUI's hook thread, see vhook_wake() */
 } global_display_t;
 
 /* Private user configuartion structure */
@@ -63,27 +115,34 @@ typedef struct app_user_data {
 } user_data_t;
 
 /* Convert between digital vibrance value to a percentage */
-int inline
+static inline int
 dv_value_to_percentage(int value, monitor_config_t *monitor_conf)
 {
-    return ((value - monitor_conf->min_vibrance) * (100)) /
-                (monitor_conf->max_vibrance - monitor_conf->min_vibrance);
+    return dv_lut_to_percentage(&monitor_conf->lut, value);
 }
 
 /* Convert between digital vibrance percentage to value */
-int inline
+static inline int
 dv_percentage_to_value(int percentage, monitor_config_t *monitor_conf)
 {
-    return (1.0f/100.0f) * ((percentage * (monitor_conf ? monitor_conf->max_vibrance : 1023)) +      \
-            (100 * (monitor_conf ? monitor_conf->min_vibrance : -1024)) -                            \
-            (percentage * (monitor_conf ? monitor_conf->min_vibrance : -1024)));
+    return dv_lut_to_value(&monitor_conf->lut, percentage);
 }
 
-void set_monitor_vibrance(int, int,
+void set_monitor_vibrance(global_display_t *, int, int,
                         bool);
-bool get_monitor_vibrance(int *, int);
 
-void __reset_monitor_vibrance(int, bool);
+void __reset_monitor_vibrance(global_display_t *, int, int);
+
+void display_profile_set(display_profile_t *, int,
+                        enum display_attribute, int);
+void display_profile_set_rule(global_display_t *, display_profile_t *, int,
+                        const display_settings_t *);
+int apply_display_profile(global_display_t *, const display_profile_t *);
+
+int monitor_config_init_vibrance(global_display_t *, monitor_config_t *,
+                        int, const dv_curve_t *);
+int device_display_config_init(global_display_t *);
+void device_display_config_free(global_display_t *);
 
 extern global_display_t gdisplay;
 extern user_data_t user_data;
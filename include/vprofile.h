@@ -0,0 +1,36 @@
+/*
+ *   Copyright (c) 2025 Roi
+
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VPROFILE_H
+#define VPROFILE_H
+
+/* NV-CONTROL display attributes a profile can drive */
+enum display_attribute {
+    DATTR_DIGITAL_VIBRANCE,
+    DATTR_IMAGE_SHARPENING,
+    DATTR_COLOR_RANGE,
+    DATTR_COLOR_SPACE,
+    DATTR_COUNT,
+};
+
+/* Attributes to apply on a single display; only those set in @mask are used */
+typedef struct display_settings {
+    unsigned int mask; /* (1 << enum display_attribute) */
+    int value[DATTR_COUNT];
+} display_settings_t;
+
+#endif /* VPROFILE_H */
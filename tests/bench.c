@@ -0,0 +1,790 @@
+/*
+ *   Copyright (c) 2025 Roi
+
+ *   Property tests and microbenchmarks for the conversion tables, the rule
+ *   table and the hook's event dispatch, run against the mock backend.
+
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <sys/wait.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vibrancelui.h"
+#include "ghashtable.h"
+#include "vhook.h"
+#include "vdaemon.h"
+#include "vapply.h"
+#include "mock_backend.h"
+
+#define CONVERSION_ITERATIONS   10000000
+#define TABLE_ENTRIES           100000
+#define DISPATCH_ITERATIONS     200000
+#define APPLY_ITERATIONS        10000
+
+#define CHECK(cond) do {                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond);    \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+static int failures;
+
+/* Every allocation of the process, glib's included, goes through here */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static unsigned long allocations;
+
+void *malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    allocations++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+/* Measurement of one benchmark */
+struct bench {
+    const char *name;
+    struct timespec start;
+    unsigned long allocations;
+};
+
+static void bench_start(struct bench *b, const char *name)
+{
+    b->name = name;
+    b->allocations = allocations;
+    clock_gettime(CLOCK_MONOTONIC, &b->start);
+}
+
+static void bench_stop(struct bench *b, unsigned long ops)
+{
+    struct timespec end;
+    double ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = (end.tv_sec - b->start.tv_sec) * 1e9 + (end.tv_nsec - b->start.tv_nsec);
+
+    printf("%-36s %10lu ops %10.2f ns/op %8.3f allocs/op\n", b->name, ops,
+            ns / ops, (double)(allocations - b->allocations) / ops);
+}
+
+/* dv_lut_t */
+
+static void check_lut(const dv_lut_t *lut, bool injective)
+{
+    int p, v;
+
+    CHECK(lut->to_value[0] == lut->min);
+    CHECK(lut->to_value[100] == lut->max);
+
+    for (p = 1; p <= 100; p++)
+        CHECK(lut->to_value[p] >= lut->to_value[p - 1]);
+
+    /* Percentage -> value -> percentage is the identity */
+    if (injective) {
+        for (p = 0; p <= 100; p++)
+            CHECK(dv_lut_to_percentage(lut, dv_lut_to_value(lut, p)) == p);
+    }
+
+    /* A value never maps to a percentage above it */
+    for (v = lut->min; v <= lut->max; v++)
+        CHECK(dv_lut_to_value(lut, dv_lut_to_percentage(lut, v)) <= v);
+}
+
+static void test_conversion()
+{
+    const char *curves[] = { "gamma=0.5", "gamma=2.2", "0:0,50:30,100:100", "0:0,20:60,100:100" };
+    const char *malformed[] = { "gamma=-1", "gamma=", "10:20,5:30", "0:0;100:100", "101:0", "abc" };
+    dv_lut_t lut = { 0 };
+    dv_curve_t curve;
+    int64_t min, max;
+    unsigned int i;
+
+    /* Linear over every range a panel can report, at a 4 step stride;
+        ranges of at least 100 steps must round-trip exactly */
+    for (min = DEFAULT_MIN_VIBRANCE_LEVEL; min <= 0; min += 4) {
+        for (max = min + 1; max <= DEFAULT_MAX_VIBRANCE_LEVEL; max += 4) {
+            CHECK(dv_lut_build(&lut, min, max, NULL) == 0);
+            check_lut(&lut, max - min >= 100);
+        }
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(curves); i++) {
+        CHECK(dv_curve_parse(curves[i], &curve) == 0);
+        CHECK(dv_lut_build(&lut, DEFAULT_MIN_VIBRANCE_LEVEL, DEFAULT_MAX_VIBRANCE_LEVEL, &curve) == 0);
+        check_lut(&lut, false);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(malformed); i++)
+        CHECK(dv_curve_parse(malformed[i], &curve) == -1);
+
+    CHECK(dv_lut_build(&lut, 10, 10, NULL) == -1);
+    dv_lut_free(&lut);
+}
+
+static void bench_conversion()
+{
+    monitor_config_t monitor_conf = { .min_vibrance = DEFAULT_MIN_VIBRANCE_LEVEL,
+                                      .max_vibrance = DEFAULT_MAX_VIBRANCE_LEVEL };
+    volatile int sink = 0;
+    struct bench b;
+    long i;
+
+    dv_lut_build(&monitor_conf.lut, monitor_conf.min_vibrance, monitor_conf.max_vibrance, NULL);
+
+    bench_start(&b, "dv_percentage_to_value");
+    for (i = 0; i < CONVERSION_ITERATIONS; i++)
+        sink += dv_percentage_to_value(i % 101, &monitor_conf);
+    bench_stop(&b, CONVERSION_ITERATIONS);
+
+    bench_start(&b, "dv_value_to_percentage");
+    for (i = 0; i < CONVERSION_ITERATIONS; i++)
+        sink += dv_value_to_percentage(i % 2048 - 1024, &monitor_conf);
+    bench_stop(&b, CONVERSION_ITERATIONS);
+
+    dv_lut_free(&monitor_conf.lut);
+    (void)sink;
+}
+
+/* rule_table_t */
+
+/* Vibrance percentage the rule of @spid carries, -1 if it has no rule */
+static int pid_rule_vibrance(rule_table_t *rules, const char *spid)
+{
+    display_settings_t settings;
+
+    if (!fetch_settings_for_spid_ht(rules, spid, &settings))
+        return -1;
+    return settings.value[DATTR_DIGITAL_VIBRANCE];
+}
+
+static int window_rule_vibrance(rule_table_t *rules, const char *instance,
+                        const char *title, const char *role)
+{
+    const window_rule_t *rule = glib_match_window_rule(rules, instance, title, role);
+
+    return rule ? rule->settings.value[DATTR_DIGITAL_VIBRANCE] : -1;
+}
+
+static void test_rule_table()
+{
+    rule_table_t *rules = glib_new_hash_table();
+    const window_rule_t *rule;
+    display_settings_t settings;
+    struct pollfd pfd;
+    char spid[21 + 1];
+    pid_t child;
+
+    mock.pidfd_enosys = false;
+
+    /* Keys are normalized to what the hook formats from _NET_WM_PID */
+    snprintf(spid, sizeof(spid), "00%d", getpid());
+    CHECK(glib_insert_new_value(rules, spid, "42"));
+    snprintf(spid, sizeof(spid), "%d", getpid());
+    CHECK(pid_rule_vibrance(rules, spid) == 42);
+    CHECK(glib_insert_new_value(rules, spid, "43")); /* Replaces the level */
+    CHECK(pid_rule_vibrance(rules, spid) == 43);
+    CHECK(!glib_insert_new_value(rules, "0", "42"));
+    CHECK(!glib_insert_new_value(rules, "abc", "42"));
+
+    /* A rule goes away as soon as its process exits */
+    child = fork();
+    if (child == 0) {
+        pause();
+        _exit(0);
+    }
+    snprintf(spid, sizeof(spid), "%d", child);
+    CHECK(glib_insert_new_value(rules, spid, "70"));
+    CHECK(pid_rule_vibrance(rules, spid) == 70);
+
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+
+    pfd.fd = glib_rules_pollfd(rules);
+    pfd.events = POLLIN;
+    CHECK(poll(&pfd, 1, 1000) == 1);
+    CHECK(glib_reap_exited_pids(rules) == 1);
+    CHECK(glib_pid_evictions(rules) == 1);
+    CHECK(pid_rule_vibrance(rules, spid) == -1);
+
+    /* Its PID can't be handed out to a rule anymore */
+    CHECK(!glib_insert_new_value(rules, spid, "70"));
+
+    /* Window rules */
+    CHECK(glib_insert_window_rule(rules, "title:*YouTube*=60"));
+    CHECK(glib_insert_window_rule(rules, "class:mpv=80"));
+    CHECK(glib_insert_window_rule(rules, "title:a=b=30"));
+    CHECK(!glib_insert_window_rule(rules, "class:=80"));
+    CHECK(!glib_insert_window_rule(rules, "name:mpv=80"));
+    CHECK(window_rule_vibrance(rules, "firefox", "Video - YouTube", NULL) == 60);
+    CHECK(window_rule_vibrance(rules, "mpv", NULL, NULL) == 80);
+    CHECK(window_rule_vibrance(rules, "firefox", "a=b", NULL) == 30);
+    CHECK(window_rule_vibrance(rules, "firefox", "Inbox", "browser") == -1);
+
+    /* Rules carrying a profile rather than a level */
+    CHECK(glib_insert_window_rule(rules, "class:game=vibrance=90,sharpening=128,color_range=1"));
+    CHECK(glib_insert_window_rule(rules, "title:x=y=sharpening=5"));
+    CHECK(!glib_insert_window_rule(rules, "class:game=vibrance=90,gamma"));
+    rule = glib_match_window_rule(rules, "game", NULL, NULL);
+    CHECK(rule && rule->settings.mask == (1U << DATTR_DIGITAL_VIBRANCE |
+                1U << DATTR_IMAGE_SHARPENING | 1U << DATTR_COLOR_RANGE));
+    CHECK(rule && rule->settings.value[DATTR_IMAGE_SHARPENING] == 128);
+    rule = glib_match_window_rule(rules, "other", "x=y", NULL);
+    CHECK(rule && rule->settings.mask == 1U << DATTR_IMAGE_SHARPENING);
+
+    snprintf(spid, sizeof(spid), "%d", getpid());
+    CHECK(glib_insert_new_value(rules, spid, "vibrance=10,color_space=2"));
+    CHECK(fetch_settings_for_spid_ht(rules, spid, &settings));
+    CHECK(settings.value[DATTR_DIGITAL_VIBRANCE] == 10 && settings.value[DATTR_COLOR_SPACE] == 2);
+    CHECK(!glib_insert_new_value(rules, spid, "color_space="));
+    CHECK(!glib_insert_new_value(rules, spid, ""));
+
+    glib_free_hash_table(rules);
+}
+
+static void bench_rule_table()
+{
+    rule_table_t *rules;
+    char (*keys)[21 + 1];
+    display_settings_t settings;
+    volatile int sink = 0;
+    struct bench b;
+    int i;
+
+    /* No pidfds, so thousands of rules don't run into RLIMIT_NOFILE */
+    mock.pidfd_enosys = true;
+
+    keys = g_malloc(TABLE_ENTRIES * sizeof(*keys));
+    for (i = 0; i < TABLE_ENTRIES; i++)
+        snprintf(keys[i], sizeof(keys[i]), "%d", i + 1);
+
+    /* From empty, so the table resizes along the way */
+    rules = glib_new_hash_table();
+    bench_start(&b, "glib_insert_new_value (resizing)");
+    for (i = 0; i < TABLE_ENTRIES; i++)
+        glib_insert_new_value(rules, keys[i], "50");
+    bench_stop(&b, TABLE_ENTRIES);
+    CHECK(g_hash_table_size(rules->ht) == TABLE_ENTRIES);
+
+    bench_start(&b, "fetch_settings_for_spid_ht (hit)");
+    for (i = 0; i < TABLE_ENTRIES; i++)
+        sink += fetch_settings_for_spid_ht(rules, keys[i], &settings);
+    bench_stop(&b, TABLE_ENTRIES);
+
+    bench_start(&b, "fetch_settings_for_spid_ht (miss)");
+    for (i = 0; i < TABLE_ENTRIES; i++)
+        sink += fetch_settings_for_spid_ht(rules, "0", &settings);
+    bench_stop(&b, TABLE_ENTRIES);
+
+    glib_free_hash_table(rules);
+    g_free(keys);
+    mock.pidfd_enosys = false;
+    (void)sink;
+}
+
+/* Event dispatch */
+
+static void dispatch(global_display_t *gd)
+{
+    vhook_dispatch_pending(gd);
+}
+
+static int display_vibrance(global_display_t *gd, int mon)
+{
+    return mock_attribute(gd->monitors_conf[mon].dpyId - MOCK_DPYID_BASE, DATTR_DIGITAL_VIBRANCE);
+}
+
+static void open_mock_display(global_display_t *gd, int nscreens, int ndisplays)
+{
+    mock_backend_reset(nscreens, ndisplays);
+    memset(gd, 0, sizeof(*gd));
+    gd->dpy = mock_display_open();
+    CHECK(device_display_config_init(gd) == 0);
+    gd->rules = glib_new_hash_table();
+    vhook_display_init(gd);
+}
+
+static void close_mock_display(global_display_t *gd)
+{
+    device_display_config_free(gd);
+    glib_free_hash_table(gd->rules);
+    mock_display_close(gd->dpy);
+}
+
+static void test_dispatch()
+{
+    mock_window_t *game, *other, *browser;
+    const window_rule_t *rule;
+    unsigned long reads;
+    global_display_t gd;
+    char spid[21 + 1];
+    int mon, percentage;
+
+    open_mock_display(&gd, 2, 2);
+    CHECK(gd.nscreens == 2 && gd.ndisplays == 4);
+    CHECK(gd.screens[1].monitors_conf == &gd.monitors_conf[2]);
+    CHECK(gd.monitors_conf[3].dpyId == MOCK_DPYID_BASE + 3);
+
+    /* Our own PID, since rules need a live process */
+    game = mock_add_window(getpid(), "game", "Game", NULL);
+    other = mock_add_window(1, "xterm", "xterm", NULL);
+    browser = mock_add_window(1, "firefox", "Video - YouTube", "browser");
+    snprintf(spid, sizeof(spid), "%d", getpid());
+    glib_insert_new_value(gd.rules, spid, "100");
+    glib_insert_window_rule(gd.rules, "title:*YouTube*=75");
+
+    /* Only the focused screen's displays change */
+    mock_focus(gd.dpy, 0, game->id);
+    dispatch(&gd);
+    CHECK(display_vibrance(&gd, 0) == DEFAULT_MAX_VIBRANCE_LEVEL);
+    CHECK(display_vibrance(&gd, 1) == DEFAULT_MAX_VIBRANCE_LEVEL);
+    CHECK(display_vibrance(&gd, 2) == 0 && display_vibrance(&gd, 3) == 0);
+
+    mock_focus(gd.dpy, 0, other->id);
+    dispatch(&gd);
+    for (mon = 0; mon < gd.ndisplays; mon++)
+        CHECK(display_vibrance(&gd, mon) == 0);
+
+    /* Window rules win over the PID, and are resolved only once */
+    mock_focus(gd.dpy, 1, browser->id);
+    dispatch(&gd);
+    CHECK(display_vibrance(&gd, 2) == dv_percentage_to_value(75, &gd.monitors_conf[2]));
+    CHECK(display_vibrance(&gd, 0) == 0);
+
+    mock_focus(gd.dpy, 1, other->id);
+    dispatch(&gd);
+    reads = mock.property_reads;
+    mock_focus(gd.dpy, 1, browser->id);
+    dispatch(&gd);
+    CHECK(mock.property_reads - reads <= 3); /* Active window, type, size: no title */
+    CHECK(display_vibrance(&gd, 2) == dv_percentage_to_value(75, &gd.monitors_conf[2]));
+
+    /* Renaming the focused window re-resolves it on the spot */
+    mock_set_title(gd.dpy, browser, "Inbox");
+    dispatch(&gd);
+    CHECK(display_vibrance(&gd, 2) == 0);
+
+    /* Title and role rules get windows listened to for renames only,
+        never for their geometry, whether they matched or not */
+    CHECK(browser->event_mask == PropertyChangeMask);
+    mock_focus(gd.dpy, 1, other->id);
+    dispatch(&gd);
+    CHECK(other->event_mask == PropertyChangeMask);
+
+    /* Windows that matched nothing are resolved only once as well */
+    mock_focus(gd.dpy, 1, browser->id);
+    dispatch(&gd);
+    reads = mock.property_reads;
+    mock_focus(gd.dpy, 1, other->id);
+    dispatch(&gd);
+    CHECK(mock.property_reads - reads <= 3); /* Active window, type, PID: no title */
+
+    /* An unfocused window renamed into a match is picked up on its focus */
+    mock_set_title(gd.dpy, browser, "Video - YouTube");
+    dispatch(&gd);
+    mock_focus(gd.dpy, 1, browser->id);
+    dispatch(&gd);
+    CHECK(display_vibrance(&gd, 2) == dv_percentage_to_value(75, &gd.monitors_conf[2]));
+    mock_focus(gd.dpy, 1, other->id);
+    dispatch(&gd);
+    CHECK(browser->event_mask == PropertyChangeMask);
+
+    /* A window destroyed before its focus is handled gets no rule, even
+        though it's still cached as matched; then it drops out of the cache */
+    CHECK(glib_window_cache_lookup(gd.rules, browser->id, &rule));
+    mock_focus(gd.dpy, 1, browser->id);
+    mock_destroy_window(gd.dpy, browser);
+    dispatch(&gd);
+    CHECK(display_vibrance(&gd, 2) == 0);
+    CHECK(!glib_window_cache_lookup(gd.rules, browser->id, &rule));
+
+    /* Refocusing without a change doesn't touch the driver */
+    mock_focus(gd.dpy, 0, other->id);
+    reads = mock.nv_writes;
+    dispatch(&gd);
+    CHECK(mock.nv_writes == reads);
+
+    /* Leaving a rule app goes back to the slider's baseline, in one flush */
+    set_monitor_vibrance(&gd, 0, 75, false);
+    CHECK(gd.monitors_conf[0].vibrance_level == dv_percentage_to_value(75, &gd.monitors_conf[0]));
+    mock_focus(gd.dpy, 0, game->id);
+    dispatch(&gd);
+    CHECK(display_vibrance(&gd, 0) == DEFAULT_MAX_VIBRANCE_LEVEL);
+    reads = mock.flushes;
+    mock_focus(gd.dpy, 0, other->id);
+    dispatch(&gd);
+    CHECK(display_vibrance(&gd, 0) == gd.monitors_conf[0].vibrance_level);
+    CHECK(display_vibrance(&gd, 1) == 0);
+    CHECK(mock.flushes - reads == 1);
+
+    close_mock_display(&gd);
+
+    /* Class rules alone never need listening to any window */
+    open_mock_display(&gd, 1, 1);
+    game = mock_add_window(1, "game", "Game", NULL);
+    other = mock_add_window(1, "xterm", "xterm", NULL);
+    glib_insert_window_rule(gd.rules, "class:game=80");
+    mock_focus(gd.dpy, 0, game->id);
+    dispatch(&gd);
+    mock_focus(gd.dpy, 0, other->id);
+    dispatch(&gd);
+    CHECK(game->event_mask == NoEventMask && other->event_mask == NoEventMask);
+    CHECK(glib_window_cache_lookup(gd.rules, other->id, &rule) && rule == NULL);
+    close_mock_display(&gd);
+
+    /* The slider's percentage goes through every monitor's own range,
+        not the selected one's, and out of range ones are refused */
+    mock_backend_reset(1, 2);
+    mock.display_vibrance_max[1] = 2047;
+    memset(&gd, 0, sizeof(gd));
+    gd.dpy = mock_display_open();
+    CHECK(device_display_config_init(&gd) == 0);
+    reads = mock.flushes;
+    set_monitor_vibrance(&gd, 0, 100, true);
+    CHECK(display_vibrance(&gd, 0) == DEFAULT_MAX_VIBRANCE_LEVEL);
+    CHECK(display_vibrance(&gd, 1) == 2047);
+    CHECK(gd.monitors_conf[1].vibrance_level == 2047);
+    CHECK(mock.flushes - reads == 1);
+    set_monitor_vibrance(&gd, 0, 101, true);
+    CHECK(display_vibrance(&gd, 1) == 2047);
+    device_display_config_free(&gd);
+    mock_display_close(gd.dpy);
+
+    /* Opening the window or picking a monitor only shows its baseline on
+        the slider, with the slider's handler blocked (see vgui.c, which
+        isn't part of the suite): the percentage doesn't round trip through
+        the table, 500 shows as 74% which is 491, so neither the baseline
+        nor the driver may see it */
+    mock_backend_reset(1, 2);
+    mock.attrs[0][DATTR_DIGITAL_VIBRANCE] = 500;
+    memset(&gd, 0, sizeof(gd));
+    gd.dpy = mock_display_open();
+    CHECK(device_display_config_init(&gd) == 0);
+    percentage = dv_value_to_percentage(gd.monitors_conf[0].vibrance_level,
+                    &gd.monitors_conf[0]);
+    CHECK(percentage == 74);
+    CHECK(dv_percentage_to_value(percentage, &gd.monitors_conf[0]) == 491);
+    CHECK(gd.monitors_conf[0].vibrance_level == 500);
+    CHECK(mock.nv_writes == 0);
+    device_display_config_free(&gd);
+    mock_display_close(gd.dpy);
+}
+
+static void test_screens()
+{
+    mock_window_t *game;
+    global_display_t gd;
+    int mon;
+
+    /* More displays than the GUI's monitor list, and each display sized
+        after its own monitor on its own screen */
+    mock_backend_reset(2, 9);
+    mock.display_width[11] = 2560;
+    mock.display_height[11] = 1440;
+    memset(&gd, 0, sizeof(gd));
+    gd.dpy = mock_display_open();
+    CHECK(device_display_config_init(&gd) == 0);
+    gd.rules = glib_new_hash_table();
+    vhook_display_init(&gd);
+    CHECK(gd.ndisplays == 18);
+    CHECK(gd.monitors_conf[11].width == 2560 && gd.monitors_conf[11].height == 1440);
+    CHECK(gd.monitors_conf[10].width == MOCK_SCREEN_WIDTH);
+    CHECK(gd.monitors_conf[2].width == MOCK_SCREEN_WIDTH);
+
+    game = mock_add_window(1, "game", "Game", NULL);
+    CHECK(glib_insert_window_rule(gd.rules, "class:game=100"));
+    mock_focus(gd.dpy, 1, game->id);
+    dispatch(&gd);
+    for (mon = 9; mon < gd.ndisplays; mon++)
+        CHECK(display_vibrance(&gd, mon) == DEFAULT_MAX_VIBRANCE_LEVEL);
+    CHECK(display_vibrance(&gd, 8) == 0);
+
+    close_mock_display(&gd);
+}
+
+/* The daemon serves several displays from one thread, each with its own
+    global_display_t; nothing of one may leak into another */
+static void test_contexts()
+{
+    static mock_backend_t seat1;
+    global_display_t gds[2];
+    mock_window_t *game0, *game1, *term1;
+    unsigned long writes;
+    int i;
+
+    mock_backend_reset(1, 2);
+    mock_backend_init(&seat1, 1, 2);
+    for (i = 0; i < 2; i++) {
+        memset(&gds[i], 0, sizeof(gds[i]));
+        gds[i].dpy = mock_display_open_on(i ? &seat1 : &mock);
+        CHECK(device_display_config_init(&gds[i]) == 0);
+        gds[i].rules = glib_new_hash_table();
+        vhook_display_init(&gds[i]);
+    }
+
+    /* Same window IDs on both servers, only seat 0 has a rule */
+    game0 = mock_add_window(1, "game", "Game", NULL);
+    game1 = mock_add_window_on(&seat1, 1, "game", "Game", NULL);
+    term1 = mock_add_window_on(&seat1, 1, "xterm", "xterm", NULL);
+    CHECK(game0->id == game1->id);
+    CHECK(glib_insert_window_rule(gds[0].rules, "class:game=100"));
+
+    /* Focus on one seat doesn't show up on the other */
+    mock_focus(gds[0].dpy, 0, game0->id);
+    writes = seat1.nv_writes;
+    dispatch(&gds[0]);
+    dispatch(&gds[1]);
+    CHECK(gds[0].screens[0].active_window == game0->id);
+    CHECK(gds[1].screens[0].active_window == 0);
+    CHECK(mock_attribute(0, DATTR_DIGITAL_VIBRANCE) == DEFAULT_MAX_VIBRANCE_LEVEL);
+    CHECK(gds[0].monitors_conf[0].attr_cache[DATTR_DIGITAL_VIBRANCE] == DEFAULT_MAX_VIBRANCE_LEVEL);
+    CHECK(gds[1].monitors_conf[0].attr_cache[DATTR_DIGITAL_VIBRANCE] == 0);
+    CHECK(seat1.nv_writes == writes);
+
+    /* Same window on seat 1: its rules don't have one for it */
+    mock_focus(gds[1].dpy, 0, game1->id);
+    dispatch(&gds[1]);
+    CHECK(gds[1].screens[0].active_window == game1->id);
+    CHECK(seat1.attrs[0][DATTR_DIGITAL_VIBRANCE] == 0);
+    CHECK(seat1.nv_writes == writes);
+
+    /* Rule and baseline of seat 1 don't affect seat 0 */
+    CHECK(glib_insert_window_rule(gds[1].rules, "class:xterm=0"));
+    set_monitor_vibrance(&gds[1], 0, 25, true);
+    mock_focus(gds[1].dpy, 0, term1->id);
+    dispatch(&gds[1]);
+    CHECK(seat1.attrs[0][DATTR_DIGITAL_VIBRANCE] == DEFAULT_MIN_VIBRANCE_LEVEL);
+    CHECK(gds[0].monitors_conf[0].vibrance_level == 0);
+    CHECK(gds[0].screens[0].active_window == game0->id);
+    CHECK(mock_attribute(0, DATTR_DIGITAL_VIBRANCE) == DEFAULT_MAX_VIBRANCE_LEVEL);
+    CHECK(glib_window_rules_count(gds[0].rules) == 1);
+
+    for (i = 0; i < 2; i++)
+        close_mock_display(&gds[i]);
+}
+
+static void test_profile()
+{
+    display_profile_t profile;
+    mock_window_t *game, *other;
+    unsigned long flushes;
+    global_display_t gd;
+    int mon;
+
+    open_mock_display(&gd, 2, 2);
+    profile = (display_profile_t)DISPLAY_PROFILE(gd.ndisplays);
+
+    /* Every attribute of every display, still a single flush */
+    for (mon = 0; mon < gd.ndisplays; mon++) {
+        display_profile_set(&profile, mon, DATTR_DIGITAL_VIBRANCE, 100 + mon);
+        display_profile_set(&profile, mon, DATTR_IMAGE_SHARPENING, 200);
+        display_profile_set(&profile, mon, DATTR_COLOR_RANGE, 1);
+        display_profile_set(&profile, mon, DATTR_COLOR_SPACE, 2);
+    }
+    flushes = mock.flushes;
+    CHECK(apply_display_profile(&gd, &profile) == DATTR_COUNT * gd.ndisplays);
+    CHECK(mock.flushes - flushes == 1);
+    for (mon = 0; mon < gd.ndisplays; mon++) {
+        CHECK(display_vibrance(&gd, mon) == 100 + mon);
+        CHECK(mock_attribute(mon, DATTR_IMAGE_SHARPENING) == 200);
+        CHECK(mock_attribute(mon, DATTR_COLOR_RANGE) == 1);
+        CHECK(mock_attribute(mon, DATTR_COLOR_SPACE) == 2);
+    }
+
+    /* Values the driver didn't report as valid never reach it: a bit
+        outside of INT_BITS, and a value outside of a RANGE */
+    memset(profile.mon, 0, profile.ndisplays * sizeof(*profile.mon));
+    display_profile_set(&profile, 0, DATTR_COLOR_RANGE, 2);
+    display_profile_set(&profile, 0, DATTR_COLOR_SPACE, 32);
+    display_profile_set(&profile, 1, DATTR_IMAGE_SHARPENING, 256);
+    display_profile_set(&profile, 1, DATTR_DIGITAL_VIBRANCE, DEFAULT_MAX_VIBRANCE_LEVEL + 1);
+    flushes = mock.flushes;
+    CHECK(apply_display_profile(&gd, &profile) == 0);
+    CHECK(mock.flushes == flushes);
+    CHECK(mock_attribute(0, DATTR_COLOR_RANGE) == 1);
+    CHECK(mock_attribute(0, DATTR_COLOR_SPACE) == 2);
+    CHECK(mock_attribute(1, DATTR_IMAGE_SHARPENING) == 200);
+    close_mock_display(&gd);
+
+    /* A rule's profile is applied on focus and reverted on leave */
+    open_mock_display(&gd, 1, 2);
+    game = mock_add_window(1, "game", "Game", NULL);
+    other = mock_add_window(1, "xterm", "xterm", NULL);
+    CHECK(glib_insert_window_rule(gd.rules, "class:game=vibrance=80,sharpening=128,color_range=1"));
+
+    mock_focus(gd.dpy, 0, game->id);
+    flushes = mock.flushes;
+    dispatch(&gd);
+    CHECK(mock.flushes - flushes == 1);
+    for (mon = 0; mon < gd.ndisplays; mon++) {
+        CHECK(display_vibrance(&gd, mon) == dv_percentage_to_value(80, &gd.monitors_conf[mon]));
+        CHECK(mock_attribute(mon, DATTR_IMAGE_SHARPENING) == 128);
+        CHECK(mock_attribute(mon, DATTR_COLOR_RANGE) == 1);
+        CHECK(mock_attribute(mon, DATTR_COLOR_SPACE) == 0);
+    }
+
+    mock_focus(gd.dpy, 0, other->id);
+    flushes = mock.flushes;
+    dispatch(&gd);
+    CHECK(mock.flushes - flushes == 1);
+    for (mon = 0; mon < gd.ndisplays; mon++) {
+        CHECK(display_vibrance(&gd, mon) == 0);
+        CHECK(mock_attribute(mon, DATTR_IMAGE_SHARPENING) == 0);
+        CHECK(mock_attribute(mon, DATTR_COLOR_RANGE) == 0);
+    }
+
+    close_mock_display(&gd);
+}
+
+static void bench_dispatch()
+{
+    mock_window_t *game, *other;
+    unsigned long writes, flushes;
+    global_display_t gd;
+    char spid[21 + 1];
+    struct bench b;
+    long i;
+
+    open_mock_display(&gd, 1, 2);
+    game = mock_add_window(getpid(), "game", "Game", NULL);
+    other = mock_add_window(1, "xterm", "xterm", NULL);
+    snprintf(spid, sizeof(spid), "%d", getpid());
+    glib_insert_new_value(gd.rules, spid, "80");
+
+    writes = mock.nv_writes;
+    flushes = mock.flushes;
+    bench_start(&b, "vhook_dispatch_pending (focus)");
+    for (i = 0; i < DISPATCH_ITERATIONS; i++) {
+        mock_focus(gd.dpy, 0, i & 1 ? other->id : game->id);
+        dispatch(&gd);
+    }
+    bench_stop(&b, DISPATCH_ITERATIONS);
+    printf("%-36s %10.2f writes/op %8.3f flushes/op\n", "",
+            (double)(mock.nv_writes - writes) / DISPATCH_ITERATIONS,
+            (double)(mock.flushes - flushes) / DISPATCH_ITERATIONS);
+
+    close_mock_display(&gd);
+}
+
+/* One-shot apply */
+
+static int run_apply(int argc, char **argv)
+{
+    optind = 0; /* Start over, getopt keeps state between calls */
+    return vib_apply_main(argc, argv);
+}
+
+static void test_apply()
+{
+    char *argv[] = { "vibrancelui", "--apply", "101=100", "103=0", "999=50" };
+    char *bad[] = { "vibrancelui", "--apply", "101" };
+    char *levels[] = { "vibrancelui", "--apply", "100=170", "101=-5", "102=70abc", "103=100" };
+    unsigned long flushes, writes, reads;
+
+    mock_backend_reset(1, 4);
+    mock.attrs[3][DATTR_DIGITAL_VIBRANCE] = 300;
+
+    /* Unknown display 999 is reported, the others still get applied */
+    flushes = mock.flushes;
+    CHECK(run_apply(G_N_ELEMENTS(argv), argv) == EXIT_FAILURE);
+    CHECK(mock_attribute(1, DATTR_DIGITAL_VIBRANCE) == DEFAULT_MAX_VIBRANCE_LEVEL);
+    CHECK(mock_attribute(3, DATTR_DIGITAL_VIBRANCE) == DEFAULT_MIN_VIBRANCE_LEVEL);
+    CHECK(mock_attribute(0, DATTR_DIGITAL_VIBRANCE) == 0);
+    CHECK(mock.flushes - flushes == 1);
+
+    /* Values are written without reading them back first, even unchanged */
+    writes = mock.nv_writes;
+    reads = mock.nv_reads;
+    run_apply(G_N_ELEMENTS(argv), argv);
+    CHECK(mock.nv_writes - writes == 2);
+    CHECK(mock.nv_reads == reads);
+
+    CHECK(run_apply(G_N_ELEMENTS(bad), bad) == EXIT_FAILURE);
+
+    /* Out of range levels and trailing garbage aren't clamped nor cut off */
+    writes = mock.nv_writes;
+    CHECK(run_apply(G_N_ELEMENTS(levels), levels) == EXIT_FAILURE);
+    CHECK(mock.nv_writes - writes == 1);
+    CHECK(mock_attribute(3, DATTR_DIGITAL_VIBRANCE) == DEFAULT_MAX_VIBRANCE_LEVEL);
+}
+
+static void bench_apply()
+{
+    char *argv[2][4] = {
+        { "vibrancelui", "--apply", "100=70", "101=70" },
+        { "vibrancelui", "--apply", "100=30", "101=30" },
+    };
+    unsigned long writes, flushes;
+    struct bench b;
+    long i;
+
+    mock_backend_reset(1, 2);
+    writes = mock.nv_writes;
+    flushes = mock.flushes;
+
+    /* Only our share of the work: the mock has no X round trips, and the
+        GTK libraries the binary links aren't loaded per run */
+    bench_start(&b, "vib_apply_main (2 displays, mock)");
+    for (i = 0; i < APPLY_ITERATIONS; i++)
+        run_apply(G_N_ELEMENTS(argv[0]), argv[i & 1]);
+    bench_stop(&b, APPLY_ITERATIONS);
+    printf("%-36s %10.2f writes/op %8.3f flushes/op\n", "",
+            (double)(mock.nv_writes - writes) / APPLY_ITERATIONS,
+            (double)(mock.flushes - flushes) / APPLY_ITERATIONS);
+
+    CHECK(mock.nv_writes - writes == 2 * APPLY_ITERATIONS);
+    CHECK(mock.flushes - flushes == APPLY_ITERATIONS);
+}
+
+int main(int argc, char *argv[])
+{
+    test_conversion();
+    test_rule_table();
+    test_dispatch();
+    test_screens();
+    test_contexts();
+    test_profile();
+    test_apply();
+
+    bench_conversion();
+    bench_rule_table();
+    bench_dispatch();
+    bench_apply();
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All checks passed\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,561 @@
+/*
+ *   Copyright (c) 2025 Roi
+
+ *   Mock X11, RandR and NV-CONTROL backend, so the benchmark suite
+ *   runs without an X server or an NVIDIA GPU.
+
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <X11/Xatom.h>
+#include <X11/extensions/Xrandr.h>
+#include <sys/syscall.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include "mock_backend.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open      434
+#endif
+
+mock_backend_t mock;
+
+/* Server a connection was opened on */
+static mock_backend_t *mock_server(Display *dpy)
+{
+    return (mock_backend_t *)((_XPrivDisplay)dpy)->private11;
+}
+
+/* Atoms handed out by XInternAtom(); predefined ones keep their value */
+static const struct {
+    const char *name;
+    Atom atom;
+} mock_atoms[] = {
+    { "WM_CLASS",               XA_WM_CLASS },
+    { "WM_NAME",                XA_WM_NAME },
+    { "_NET_ACTIVE_WINDOW",     1000 },
+    { "_NET_WM_PID",            1001 },
+    { "_NET_WM_NAME",           1002 },
+    { "_NET_WM_WINDOW_TYPE",    1003 },
+    { "WM_WINDOW_ROLE",         1004 },
+    { "_NET_CLIENT_LIST",       1005 },
+};
+
+static const char *mock_atom_name(Atom atom)
+{
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(mock_atoms); i++) {
+        if (mock_atoms[i].atom == atom)
+            return mock_atoms[i].name;
+    }
+    return NULL;
+}
+
+static Window mock_root(int screen)
+{
+    return 1 + screen;
+}
+
+/* Index of the first display enabled on @screen */
+static int mock_first_display(mock_backend_t *server, int screen)
+{
+    int i, first = 0;
+
+    for (i = 0; i < screen; i++)
+        first += server->ndisplays[i];
+    return first;
+}
+
+/* Reset the fake @server to @nscreens X screens with @ndisplays each */
+void mock_backend_init(mock_backend_t *server, int nscreens, int ndisplays)
+{
+    int screen;
+
+    memset(server, 0, sizeof(*server));
+    server->nscreens = nscreens;
+    for (screen = 0; screen < nscreens; screen++)
+        server->ndisplays[screen] = ndisplays;
+    server->vibrance_min = DEFAULT_MIN_VIBRANCE_LEVEL;
+    server->vibrance_max = DEFAULT_MAX_VIBRANCE_LEVEL;
+}
+
+void mock_backend_reset(int nscreens, int ndisplays)
+{
+    mock_backend_init(&mock, nscreens, ndisplays);
+}
+
+/* Xlib's macros (ScreenCount, RootWindow, ...) read the display structure
+    directly, so fill in the fields they use */
+Display *mock_display_open_on(mock_backend_t *server)
+{
+    _XPrivDisplay dpy;
+    int screen;
+
+    dpy = calloc(1, sizeof(*dpy));
+    dpy->private11 = (XPointer)server;
+    dpy->nscreens = server->nscreens;
+    dpy->fd = -1;
+    dpy->display_name = "mock:0";
+    dpy->screens = calloc(server->nscreens, sizeof(*dpy->screens));
+    for (screen = 0; screen < server->nscreens; screen++) {
+        dpy->screens[screen].root = mock_root(screen);
+        dpy->screens[screen].width = MOCK_SCREEN_WIDTH;
+        dpy->screens[screen].height = MOCK_SCREEN_HEIGHT;
+    }
+
+    return (Display *)dpy;
+}
+
+Display *mock_display_open()
+{
+    return mock_display_open_on(&mock);
+}
+
+void mock_display_close(Display *display)
+{
+    _XPrivDisplay dpy = (_XPrivDisplay)display;
+
+    free(dpy->screens);
+    free(dpy);
+}
+
+mock_window_t *mock_add_window_on(mock_backend_t *server, unsigned long pid,
+                        const char *instance, const char *title, const char *role)
+{
+    mock_window_t *win = &server->windows[server->nwindows];
+
+    win->id = 0x100000 + server->nwindows++;
+    win->pid = pid;
+    win->instance = instance;
+    win->title = title;
+    win->role = role;
+    win->width = MOCK_SCREEN_WIDTH;
+    win->height = MOCK_SCREEN_HEIGHT;
+
+    return win;
+}
+
+mock_window_t *mock_add_window(unsigned long pid, const char *instance,
+                        const char *title, const char *role)
+{
+    return mock_add_window_on(&mock, pid, instance, title, role);
+}
+
+static mock_window_t *mock_find_window(mock_backend_t *server, Window id)
+{
+    int i;
+
+    for (i = 0; i < server->nwindows; i++) {
+        if (server->windows[i].id == id && !server->windows[i].destroyed)
+            return &server->windows[i];
+    }
+    return NULL;
+}
+
+static void mock_queue_property_notify(Display *dpy, Window window, Atom atom)
+{
+    mock_backend_t *server = mock_server(dpy);
+    XEvent *e;
+
+    if (server->nevents == MOCK_MAX_EVENTS)
+        return;
+
+    e = &server->events[server->nevents++];
+    memset(e, 0, sizeof(*e));
+    e->xproperty.type = PropertyNotify;
+    e->xproperty.display = dpy;
+    e->xproperty.window = window;
+    e->xproperty.atom = atom;
+    e->xproperty.state = PropertyNewValue;
+}
+
+/* Focus @window on @screen, as a window manager would */
+void mock_focus(Display *dpy, int screen, Window window)
+{
+    mock_server(dpy)->active[screen] = window;
+    mock_queue_property_notify(dpy, mock_root(screen), XInternAtom(dpy, "_NET_ACTIVE_WINDOW", True));
+}
+
+void mock_set_title(Display *dpy, mock_window_t *win, const char *title)
+{
+    win->title = title;
+    mock_queue_property_notify(dpy, win->id, XInternAtom(dpy, "_NET_WM_NAME", True));
+}
+
+/* Destroy @win; the window manager drops it off the client list */
+void mock_destroy_window(Display *dpy, mock_window_t *win)
+{
+    win->destroyed = true;
+    mock_queue_property_notify(dpy, mock_root(0), XInternAtom(dpy, "_NET_CLIENT_LIST", True));
+}
+
+/* Current driver value of @attr on the display at @index */
+int mock_attribute(int index, enum display_attribute attr)
+{
+    return mock.attrs[index][attr];
+}
+
+static int mock_attribute_slot(unsigned int attribute)
+{
+    switch (attribute) {
+    case NV_CTRL_DIGITAL_VIBRANCE:
+        return DATTR_DIGITAL_VIBRANCE;
+    case NV_CTRL_IMAGE_SHARPENING:
+        return DATTR_IMAGE_SHARPENING;
+    case NV_CTRL_COLOR_RANGE:
+        return DATTR_COLOR_RANGE;
+    case NV_CTRL_COLOR_SPACE:
+        return DATTR_COLOR_SPACE;
+    default:
+        return -1;
+    }
+}
+
+static int *mock_attribute_ptr(Display *dpy, int target_id, unsigned int attribute)
+{
+    int index = target_id - MOCK_DPYID_BASE, slot = mock_attribute_slot(attribute);
+
+    if (index < 0 || index >= MOCK_MAX_DISPLAYS || slot < 0)
+        return NULL;
+    return &mock_server(dpy)->attrs[index][slot];
+}
+
+/* Xlib */
+
+Display *XOpenDisplay(_Xconst char *name)
+{
+    return mock_display_open();
+}
+
+int XCloseDisplay(Display *dpy)
+{
+    mock_display_close(dpy);
+    return 0;
+}
+
+int XFree(void *data)
+{
+    free(data);
+    return 1;
+}
+
+int XFlush(Display *dpy)
+{
+    mock_server(dpy)->flushes++;
+    return 1;
+}
+
+XErrorHandler XSetErrorHandler(XErrorHandler handler)
+{
+    return NULL;
+}
+
+int XGetErrorText(Display *dpy, int code, char *buffer, int length)
+{
+    snprintf(buffer, length, "error %d", code);
+    return 0;
+}
+
+#ifdef HAVE_X_IO_ERROR_EXIT_HANDLER
+void XSetIOErrorExitHandler(Display *dpy, XIOErrorExitHandler handler, void *data)
+{
+}
+#endif /* HAVE_X_IO_ERROR_EXIT_HANDLER */
+
+int XSelectInput(Display *dpy, Window window, long mask)
+{
+    mock_window_t *win = mock_find_window(mock_server(dpy), window);
+
+    if (win == NULL)
+        return BadWindow;
+
+    win->event_mask = mask;
+    return 1;
+}
+
+Atom XInternAtom(Display *dpy, _Xconst char *name, Bool only_if_exists)
+{
+    unsigned int i;
+    int index;
+
+    for (i = 0; i < G_N_ELEMENTS(mock_atoms); i++) {
+        if (!strcmp(mock_atoms[i].name, name))
+            return mock_atoms[i].atom;
+    }
+    if (sscanf(name, "DP-%d", &index) == 1)
+        return MOCK_RANDR_NAME_ATOM + index;
+    return None;
+}
+
+int XPending(Display *dpy)
+{
+    return mock_server(dpy)->nevents;
+}
+
+int XNextEvent(Display *dpy, XEvent *e)
+{
+    mock_backend_t *server = mock_server(dpy);
+
+    *e = server->events[0];
+    memmove(&server->events[0], &server->events[1], --server->nevents * sizeof(*e));
+    return 0;
+}
+
+Status XGetWindowAttributes(Display *dpy, Window window, XWindowAttributes *attrs)
+{
+    mock_window_t *win = mock_find_window(mock_server(dpy), window);
+
+    if (win == NULL)
+        return 0; /* Like Xlib, which reports BadWindow to the error handler */
+
+    memset(attrs, 0, sizeof(*attrs));
+    attrs->width = win->width;
+    attrs->height = win->height;
+    return 1;
+}
+
+/* 32 bit formats come back as an array of longs, strings NUL terminated */
+static void mock_return_long(unsigned long value, unsigned char **prop)
+{
+    long *data = malloc(sizeof(*data));
+
+    *data = value;
+    *prop = (unsigned char *)data;
+}
+
+/* Every live window is managed on the first screen */
+static void mock_return_client_list(mock_backend_t *server, unsigned char **prop,
+        unsigned long *nitems)
+{
+    long *data = malloc((server->nwindows + 1) * sizeof(*data));
+    int i;
+
+    *nitems = 0;
+    for (i = 0; i < server->nwindows; i++) {
+        if (!server->windows[i].destroyed)
+            data[(*nitems)++] = server->windows[i].id;
+    }
+    *prop = (unsigned char *)data;
+}
+
+int XGetWindowProperty(Display *dpy, Window window, Atom property,
+        long offset, long length, Bool delete, Atom req_type,
+        Atom *actual_type, int *actual_format, unsigned long *nitems,
+        unsigned long *bytes_after, unsigned char **prop)
+{
+    const char *name = mock_atom_name(property), *str = NULL;
+    mock_backend_t *server = mock_server(dpy);
+    mock_window_t *win;
+    int screen;
+
+    server->property_reads++;
+    *prop = NULL;
+    *actual_type = None;
+    *actual_format = 0;
+    *nitems = *bytes_after = 0;
+    if (name == NULL)
+        return BadAtom;
+
+    for (screen = 0; screen < server->nscreens; screen++) {
+        if (window == mock_root(screen)) {
+            if (!strcmp(name, "_NET_ACTIVE_WINDOW"))
+                mock_return_long(server->active[screen], prop);
+            else if (!strcmp(name, "_NET_CLIENT_LIST") && screen == 0)
+                mock_return_client_list(server, prop, nitems);
+            return Success;
+        }
+    }
+
+    win = mock_find_window(server, window);
+    if (win == NULL)
+        return BadWindow;
+
+    if (!strcmp(name, "_NET_WM_PID"))
+        mock_return_long(win->pid, prop);
+    else if (!strcmp(name, "WM_CLASS"))
+        str = win->instance;
+    else if (!strcmp(name, "_NET_WM_NAME"))
+        str = win->title;
+    else if (!strcmp(name, "WM_WINDOW_ROLE"))
+        str = win->role;
+
+    if (str)
+        *prop = (unsigned char *)strdup(str);
+
+    return Success;
+}
+
+/* RandR */
+
+/* Monitors of the screen of @window, listed backwards so that code
+    relying on their order rather than on their name gets caught */
+XRRMonitorInfo *XRRGetMonitors(Display *dpy, Window window, Bool get_active, int *nmonitors)
+{
+    mock_backend_t *server = mock_server(dpy);
+    XRRMonitorInfo *monitors;
+    int screen = window - mock_root(0), index, i;
+
+    *nmonitors = 0;
+    if (screen < 0 || screen >= server->nscreens)
+        return NULL;
+
+    *nmonitors = server->ndisplays[screen];
+    monitors = calloc(*nmonitors, sizeof(*monitors));
+    for (i = 0; i < *nmonitors; i++) {
+        index = mock_first_display(server, screen) + *nmonitors - 1 - i;
+        monitors[i].name = MOCK_RANDR_NAME_ATOM + index;
+        monitors[i].width = server->display_width[index] ? server->display_width[index] :
+                                MOCK_SCREEN_WIDTH;
+        monitors[i].height = server->display_height[index] ? server->display_height[index] :
+                                MOCK_SCREEN_HEIGHT;
+    }
+
+    return monitors;
+}
+
+void XRRFreeMonitors(XRRMonitorInfo *monitors)
+{
+    free(monitors);
+}
+
+/* NV-CONTROL */
+
+Bool XNVCTRLIsNvScreen(Display *dpy, int screen)
+{
+    return screen < mock_server(dpy)->nscreens;
+}
+
+Bool XNVCTRLQueryTargetBinaryData(Display *dpy, int target_type, int target_id,
+        unsigned int display_mask, unsigned int attribute,
+        unsigned char **ptr, int *len)
+{
+    mock_backend_t *server = mock_server(dpy);
+    int *data, i, first = mock_first_display(server, target_id);
+
+    data = calloc(server->ndisplays[target_id] + 1, sizeof(*data));
+    data[0] = server->ndisplays[target_id];
+    for (i = 0; i < data[0]; i++)
+        data[i + 1] = MOCK_DPYID_BASE + first + i;
+
+    *ptr = (unsigned char *)data;
+    if (len)
+        *len = (data[0] + 1) * sizeof(*data);
+    return True;
+}
+
+Bool XNVCTRLQueryValidTargetAttributeValues(Display *dpy, int target_type,
+        int target_id, unsigned int display_mask, unsigned int attribute,
+        NVCTRLAttributeValidValuesRec *values)
+{
+    mock_backend_t *server = mock_server(dpy);
+    int index;
+
+    memset(values, 0, sizeof(*values));
+    if (mock_attribute_ptr(dpy, target_id, attribute) == NULL)
+        return False; /* No such display */
+
+    switch (attribute) {
+    case NV_CTRL_DIGITAL_VIBRANCE:
+        index = target_id - MOCK_DPYID_BASE;
+        values->type = ATTRIBUTE_TYPE_RANGE;
+        values->u.range.min = server->vibrance_min;
+        values->u.range.max = server->vibrance_max;
+        if (index >= 0 && index < MOCK_MAX_DISPLAYS && server->display_vibrance_max[index])
+            values->u.range.max = server->display_vibrance_max[index];
+        return True;
+    case NV_CTRL_IMAGE_SHARPENING:
+        values->type = ATTRIBUTE_TYPE_RANGE;
+        values->u.range.min = 0;
+        values->u.range.max = 255;
+        return True;
+    case NV_CTRL_COLOR_RANGE:
+        values->type = ATTRIBUTE_TYPE_INT_BITS;
+        values->u.bits.ints = 0x3; /* Full, limited */
+        return True;
+    case NV_CTRL_COLOR_SPACE:
+        values->type = ATTRIBUTE_TYPE_INT_BITS;
+        values->u.bits.ints = 0x7; /* RGB, YCbCr422, YCbCr444 */
+        return True;
+    default:
+        return False;
+    }
+}
+
+Bool XNVCTRLQueryTargetAttribute(Display *dpy, int target_type, int target_id,
+        unsigned int display_mask, unsigned int attribute, int *value)
+{
+    int *attr = mock_attribute_ptr(dpy, target_id, attribute);
+
+    mock_server(dpy)->nv_reads++;
+    if (attr == NULL)
+        return False;
+    *value = *attr;
+    return True;
+}
+
+Bool XNVCTRLQueryTargetStringAttribute(Display *dpy, int target_type, int target_id,
+        unsigned int display_mask, unsigned int attribute, char **ptr)
+{
+    if (attribute != NV_CTRL_STRING_DISPLAY_NAME_RANDR)
+        return False;
+
+    *ptr = malloc(16);
+    snprintf(*ptr, 16, "DP-%d", target_id - MOCK_DPYID_BASE);
+    return True;
+}
+
+void XNVCTRLSetTargetAttribute(Display *dpy, int target_type, int target_id,
+        unsigned int display_mask, unsigned int attribute, int value)
+{
+    int *attr = mock_attribute_ptr(dpy, target_id, attribute);
+
+    mock_server(dpy)->nv_writes++;
+    if (attr)
+        *attr = value;
+}
+
+/* Kernel: linked with -Wl,--wrap=syscall, so only our objects see this */
+
+long __real_syscall(long, ...);
+
+long __wrap_syscall(long number, ...)
+{
+    va_list ap;
+    long pid, flags;
+
+    if (number != SYS_pidfd_open) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    va_start(ap, number);
+    pid = va_arg(ap, long);
+    flags = va_arg(ap, long);
+    va_end(ap);
+
+    if (mock.pidfd_enosys) {
+        errno = ENOSYS;
+        return -1;
+    }
+    return __real_syscall(number, pid, flags);
+}
+
+/* GUI, not part of the suite */
+
+int do_init_gtk_window(int argc, char **argv)
+{
+    return 0;
+}
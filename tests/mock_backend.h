@@ -0,0 +1,84 @@
+/*
+ *   Copyright (c) 2025 Roi
+
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MOCK_BACKEND_H
+#define MOCK_BACKEND_H
+
+#include "vibrancelui.h"
+
+#define MOCK_MAX_SCREENS        4
+#define MOCK_MAX_DISPLAYS       24
+#define MOCK_MAX_WINDOWS        32
+#define MOCK_MAX_EVENTS         64
+#define MOCK_DPYID_BASE         100 /* Catch code assuming IDs are 1..n */
+#define MOCK_SCREEN_WIDTH       1920
+#define MOCK_SCREEN_HEIGHT      1080
+#define MOCK_RANDR_NAME_ATOM    2000 /* Atom of "DP-<n>", n being the display index */
+
+/* Synthetic client window */
+typedef struct mock_window {
+    Window id;
+    unsigned long pid;
+    const char *instance; /* WM_CLASS instance */
+    const char *title; /* _NET_WM_NAME */
+    const char *role; /* WM_WINDOW_ROLE */
+    int width, height;
+    long event_mask; /* Last XSelectInput() on it */
+    bool destroyed;
+} mock_window_t;
+
+/* Fake X server with the NV-CONTROL extension. @mock is the one
+    connections are opened on unless told otherwise */
+typedef struct mock_backend {
+    int nscreens;
+    int ndisplays[MOCK_MAX_SCREENS]; /* Displays enabled on each X screen */
+    int64_t vibrance_min, vibrance_max;
+    int64_t display_vibrance_max[MOCK_MAX_DISPLAYS]; /* Overrides @vibrance_max if set */
+    int display_width[MOCK_MAX_DISPLAYS], /* Override the screen size if set */
+        display_height[MOCK_MAX_DISPLAYS];
+    int attrs[MOCK_MAX_DISPLAYS][DATTR_COUNT]; /* By display target ID - MOCK_DPYID_BASE */
+
+    mock_window_t windows[MOCK_MAX_WINDOWS];
+    int nwindows;
+    Window active[MOCK_MAX_SCREENS];
+
+    XEvent events[MOCK_MAX_EVENTS];
+    int nevents;
+
+    /* Counters for the benchmarks */
+    unsigned long nv_writes, nv_reads, flushes, property_reads;
+
+    bool pidfd_enosys; /* Act like a kernel without pidfd_open(2) */
+} mock_backend_t;
+
+extern mock_backend_t mock;
+
+void mock_backend_init(mock_backend_t *, int, int);
+void mock_backend_reset(int, int);
+Display *mock_display_open_on(mock_backend_t *);
+Display *mock_display_open();
+void mock_display_close(Display *);
+mock_window_t *mock_add_window_on(mock_backend_t *, unsigned long, const char *,
+                        const char *, const char *);
+mock_window_t *mock_add_window(unsigned long, const char *,
+                        const char *, const char *);
+void mock_focus(Display *, int, Window);
+void mock_set_title(Display *, mock_window_t *, const char *);
+void mock_destroy_window(Display *, mock_window_t *);
+int mock_attribute(int, enum display_attribute);
+
+#endif /* MOCK_BACKEND_H */
@@ -0,0 +1,114 @@
+/*
+ *   Copyright (c) 2025 Roi
+
+ *   One-shot mode: applies vibrance to the given displays and exits.
+
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+
+#include "vibrancelui.h"
+#include "vapply.h"
+
+static const struct option apply_options[] = {
+    { "apply",      no_argument,        NULL, 'A' },
+    { "display",    required_argument,  NULL, 'd' },
+    { "help",       no_argument,        NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+};
+
+static void apply_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s --apply [-d DISPLAY] DPYID=LEVEL...\n"
+            "  -d, --display DISPLAY   X display to use (default: $DISPLAY)\n"
+            "  DPYID=LEVEL             vibrance percentage for the display with that\n"
+            "                          NV-CONTROL display target ID\n",
+            prog);
+}
+
+/* One-shot mode for session scripts: only the targeted displays are
+    queried, everything is applied with a single flush, then we exit. */
+int vib_apply_main(int argc, char **argv)
+{
+    display_profile_t profile;
+    global_display_t gd = { 0 };
+    monitor_config_t *monitor_conf;
+    const char *name = NULL;
+    int opt, i, dpyid, level, end, nsettings, ret = EXIT_SUCCESS;
+    dv_curve_t curve;
+
+    while ((opt = getopt_long(argc, argv, "d:h", apply_options, NULL)) != -1) {
+        switch (opt) {
+        case 'A':
+            break;
+        case 'd':
+            name = optarg;
+            break;
+        default:
+            apply_usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    nsettings = argc - optind;
+    if (nsettings == 0) {
+        apply_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (dv_curve_parse(getenv("VIBRANCELUI_CURVE"), &curve))
+        fprintf(stderr, "Ignoring malformed VIBRANCELUI_CURVE, using a linear curve\n");
+
+    gd.dpy = XOpenDisplay(name);
+    if (gd.dpy == NULL) {
+        fprintf(stderr, "Can't open display %s\n", name ? name : "$DISPLAY");
+        return EXIT_FAILURE;
+    }
+
+    gd.monitors_conf = calloc(nsettings, sizeof(*gd.monitors_conf));
+    if (gd.monitors_conf == NULL)
+        DIE("Failed to allocate memory for internal structure\n");
+    profile = (display_profile_t)DISPLAY_PROFILE(nsettings);
+
+    for (i = optind; i < argc; i++) {
+        /* Nothing may trail the level, which is a percentage */
+        end = -1;
+        if (sscanf(argv[i], "%d=%d%n", &dpyid, &level, &end) != 2 ||
+                argv[i][end] != '\0' || level < 0 || level > 100) {
+            fprintf(stderr, "Ignoring malformed setting '%s'\n", argv[i]);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        monitor_conf = &gd.monitors_conf[gd.ndisplays];
+        if (monitor_config_init_vibrance(&gd, monitor_conf, dpyid, &curve)) {
+            fprintf(stderr, "Display %d doesn't support digital vibrance\n", dpyid);
+            dv_lut_free(&monitor_conf->lut);
+            memset(monitor_conf, 0, sizeof(*monitor_conf));
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        display_profile_set(&profile, gd.ndisplays++, DATTR_DIGITAL_VIBRANCE,
+                    dv_percentage_to_value(level, monitor_conf));
+    }
+
+    apply_display_profile(&gd, &profile);
+
+    device_display_config_free(&gd);
+    XCloseDisplay(gd.dpy);
+
+    return ret;
+}
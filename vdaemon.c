@@ -0,0 +1,306 @@
+/*
+ *   Copyright (c) 2025 Roi
+
+ *   Headless mode: serves the hook engine on one or more X displays
+ *   (e.g. one per seat) from a single thread and a single epoll loop.
+
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "vibrancelui.h"
+#include "ghashtable.h"
+#include "vhook.h"
+#include "vdaemon.h"
+
+/* A -r argument, bound to the -d given before it */
+struct daemon_rule {
+    int display; /* Index of the -d argument, -1 for every display */
+    char *spec; /* PID=SETTINGS or a window rule, see glib_insert_window_rule() */
+};
+
+static const struct option daemon_options[] = {
+    { "daemon",     no_argument,        NULL, 'D' },
+    { "display",    required_argument,  NULL, 'd' },
+    { "rule",       required_argument,  NULL, 'r' },
+    { "help",       no_argument,        NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+};
+
+static void daemon_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s --daemon [-d DISPLAY]... [-r RULE=SETTINGS]...\n"
+            "  -d, --display DISPLAY      X display to serve (default: $DISPLAY), repeatable\n"
+            "  -r, --rule RULE=SETTINGS   settings for a process or windows; applies to the\n"
+            "                             preceding -d, or to every display if none\n"
+            "                             precedes it. RULE is one of:\n"
+            "                               <pid>\n"
+            "                               class:<WM_CLASS instance>\n"
+            "                               title:<glob on the window title>\n"
+            "                               role:<WM_WINDOW_ROLE>\n"
+            "                             SETTINGS is a vibrance percentage, or a list of\n"
+            "                             vibrance=<percentage>, sharpening=<value>,\n"
+            "                             color_range=<value> and color_space=<value>\n"
+            "                             separated by commas\n",
+            prog);
+}
+
+static void daemon_add_rule(global_display_t *gd, char *spec)
+{
+    char *settings;
+
+    if (glib_insert_window_rule(gd->rules, spec))
+        return;
+
+    settings = strchr(spec, '=');
+    if (settings == NULL) {
+        fprintf(stderr, "Ignoring malformed rule '%s'\n", spec);
+        return;
+    }
+
+    *settings++ = '\0';
+    if (!glib_insert_new_value(gd->rules, spec, settings))
+        fprintf(stderr, "Ignoring rule for process %s\n", spec);
+    settings[-1] = '=';
+}
+
+#ifdef HAVE_X_IO_ERROR_EXIT_HANDLER
+/* The connection of @data died, e.g. the X server of its seat exited.
+    Return rather than let Xlib exit, so the other displays keep being
+    served; the main loop drops this one once the dispatch unwinds. */
+static void daemon_io_error_exit(Display *dpy, void *data)
+{
+    global_display_t *gd = data;
+
+    fprintf(stderr, "Lost the connection to %s, no longer serving it\n",
+            DisplayString(dpy));
+    gd->connection_lost = true;
+}
+#endif
+
+/* Connect to @name and get it ready to be served; NULL for $DISPLAY */
+static int daemon_display_open(global_display_t *gd, const char *name)
+{
+    gd->dpy = XOpenDisplay(name);
+    if (gd->dpy == NULL) {
+        fprintf(stderr, "Can't open display %s, skipping it\n", name ? name : "$DISPLAY");
+        return -1;
+    }
+
+    if (device_display_config_init(gd)) {
+        fprintf(stderr, "No NVIDIA X screen on %s, skipping it\n", DisplayString(gd->dpy));
+        XCloseDisplay(gd->dpy);
+        gd->dpy = NULL;
+        return -1;
+    }
+
+    gd->rules = glib_new_hash_table();
+    vhook_display_init(gd);
+
+    /* libX11 older than 1.8 exits the whole process instead */
+#ifdef HAVE_X_IO_ERROR_EXIT_HANDLER
+    XSetIOErrorExitHandler(gd->dpy, daemon_io_error_exit, gd);
+#endif
+
+    return 0;
+}
+
+static void daemon_display_close(global_display_t *gd)
+{
+    if (gd->dpy == NULL)
+        return;
+
+    /* Leave the displays the way the user had them */
+    if (!gd->connection_lost)
+        __reset_monitor_vibrance(gd, 0, gd->ndisplays);
+
+    device_display_config_free(gd);
+    glib_free_hash_table(gd->rules);
+    XCloseDisplay(gd->dpy);
+    gd->dpy = NULL;
+}
+
+/* Stop serving @gd, whose connection died */
+static void daemon_display_drop(int epfd, global_display_t *gd)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, ConnectionNumber(gd->dpy), NULL);
+    if (glib_rules_pollfd(gd->rules) >= 0)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, glib_rules_pollfd(gd->rules), NULL);
+    daemon_display_close(gd);
+}
+
+/* Drop the rules of exited processes, and say so: with no GUI around,
+    the log is the only place a disappearing rule shows up */
+static void daemon_reap_rules(global_display_t *gd)
+{
+    guint reaped;
+
+    reaped = glib_reap_exited_pids(gd->rules);
+    if (reaped)
+        fprintf(stderr, "%s: removed %u rule(s) of exited processes (%u total)\n",
+                DisplayString(gd->dpy), reaped, glib_pid_evictions(gd->rules));
+}
+
+int vib_daemon_main(int argc, char **argv)
+{
+    const char *names[MAX_DAEMON_DISPLAYS];
+    struct daemon_rule rules[MAX_DAEMON_RULES];
+    struct epoll_event ev, evs[MAX_DAEMON_EVENTS];
+    struct signalfd_siginfo siginfo;
+    global_display_t *gds, *gd;
+    int nnames = 0, nrules = 0, nserved = 0;
+    int opt, epfd, sigfd, i, n;
+    bool stop = false;
+    sigset_t sigs;
+
+    while ((opt = getopt_long(argc, argv, "d:r:h", daemon_options, NULL)) != -1) {
+        switch (opt) {
+        case 'D':
+            break;
+        case 'd':
+            if (nnames == MAX_DAEMON_DISPLAYS) {
+                fprintf(stderr, "Too many displays, at most %d are supported\n",
+                        MAX_DAEMON_DISPLAYS);
+                return EXIT_FAILURE;
+            }
+            names[nnames++] = optarg;
+            break;
+        case 'r':
+            if (nrules == MAX_DAEMON_RULES) {
+                fprintf(stderr, "Too many rules, at most %d are supported\n",
+                        MAX_DAEMON_RULES);
+                return EXIT_FAILURE;
+            }
+            rules[nrules].display = nnames - 1;
+            rules[nrules++].spec = optarg;
+            break;
+        default:
+            daemon_usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (nnames == 0)
+        names[nnames++] = NULL;
+
+    /* One compact context per display, instead of the GUI's @gdisplay */
+    gds = calloc(nnames, sizeof(*gds));
+    if (gds == NULL)
+        DIE("Failed to allocate memory for internal structure\n");
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+        DIE("epoll_create1");
+
+    /* Termination is handled in the loop, so the baseline of every display
+        gets restored before exiting */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGINT);
+    sigprocmask(SIG_BLOCK, &sigs, NULL);
+    sigfd = signalfd(-1, &sigs, SFD_CLOEXEC);
+    if (sigfd < 0)
+        DIE("signalfd");
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = DAEMON_EV_DATA(0, DAEMON_FD_SIGNAL);
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
+
+    for (i = 0; i < nnames; i++) {
+        gd = &gds[i];
+        if (daemon_display_open(gd, names[i]))
+            continue;
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = DAEMON_EV_DATA(i, DAEMON_FD_X);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, ConnectionNumber(gd->dpy), &ev);
+        if (glib_rules_pollfd(gd->rules) >= 0) {
+            ev.data.u64 = DAEMON_EV_DATA(i, DAEMON_FD_RULES);
+            epoll_ctl(epfd, EPOLL_CTL_ADD, glib_rules_pollfd(gd->rules), &ev);
+        }
+        nserved++;
+    }
+
+    if (nserved == 0) {
+        fprintf(stderr, "No display to serve; aborting.\n");
+        free(gds);
+        close(sigfd);
+        close(epfd);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < nrules; i++) {
+        for (n = 0; n < nnames; n++) {
+            if (gds[n].dpy && (rules[i].display < 0 || rules[i].display == n))
+                daemon_add_rule(&gds[n], rules[i].spec);
+        }
+    }
+
+    /* Flush the event masks and pick up whatever is already queued */
+    for (i = 0; i < nnames; i++) {
+        if (gds[i].dpy)
+            vhook_dispatch_pending(&gds[i]);
+    }
+
+    while (!stop) {
+        /* A dead connection only affects its own seat */
+        for (i = 0; i < nnames; i++) {
+            if (gds[i].dpy && gds[i].connection_lost) {
+                daemon_display_drop(epfd, &gds[i]);
+                nserved--;
+            }
+        }
+        if (nserved == 0) {
+            fprintf(stderr, "No display left to serve; exiting.\n");
+            break;
+        }
+
+        n = epoll_wait(epfd, evs, MAX_DAEMON_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (DAEMON_EV_KIND(evs[i].data.u64) == DAEMON_FD_SIGNAL) {
+                if (read(sigfd, &siginfo, sizeof(siginfo)) == sizeof(siginfo))
+                    fprintf(stderr, "Caught signal %u, restoring the displays\n",
+                            siginfo.ssi_signo);
+                stop = true;
+                continue;
+            }
+
+            gd = &gds[DAEMON_EV_INDEX(evs[i].data.u64)];
+            if (DAEMON_EV_KIND(evs[i].data.u64) == DAEMON_FD_RULES)
+                daemon_reap_rules(gd);
+            else
+                vhook_dispatch_pending(gd);
+        }
+    }
+
+    for (i = 0; i < nnames; i++)
+        daemon_display_close(&gds[i]);
+    free(gds);
+    close(sigfd);
+    close(epfd);
+
+    return stop ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -39,30 +39,42 @@ struct g_app_config {
 
 GThread *gthread_p;
 
-/* FIXME: 
-	poll_for_event: Assertion 
-		`dpy->xcb->event_owner == XlibOwnsEventQueue &&
-			!dpy->xcb->event_waiter' failed
-	
-	Makes the program abort. Figure out the issue.
- */
+/* The hook thread shares @gdisplay: its X connection, the attribute cache
+	and the baseline we set here. Hold its lock while touching them, or
+	Xlib aborts on `dpy->xcb->event_owner == XlibOwnsEventQueue' and the
+	cache goes out of sync with the driver */
 static void vibrance_scale_callback()
 {
-	int integer_vibrance_scale;
-	gdouble __attribute_maybe_unused__ arg_range_val;
+	int percentage;
 	int monitor_number = user_data.dropd_def_mon; /* specified monitor number */
 
-	integer_vibrance_scale = dv_percentage_to_value(
-								gtk_range_get_value(GTK_RANGE(pwidgets.pvscale)),
-								&gdisplay.monitors_conf[monitor_number]);
-	arg_range_val = gtk_range_get_value(GTK_RANGE(pwidgets.pvscale));
-	set_monitor_vibrance(monitor_number, integer_vibrance_scale, user_data.affect_all);
+	/* Each monitor converts the percentage through its own table */
+	percentage = gtk_range_get_value(GTK_RANGE(pwidgets.pvscale));
+	pthread_spin_lock(&gdisplay.lock);
+	set_monitor_vibrance(&gdisplay, monitor_number, percentage, user_data.affect_all);
+	pthread_spin_unlock(&gdisplay.lock);
+	vhook_wake(&gdisplay);
 
 #ifdef DEBUG
-	DEBUG_PRINTF("%g %d %d\n", arg_range_val, integer_vibrance_scale, user_data.affect_all);
+	DEBUG_PRINTF("%d %d\n", percentage, user_data.affect_all);
 #endif
 }
 
+/* Show the baseline of the selected monitor on the slider. The slider
+	only holds percentages, which don't round trip through the monitor's
+	table, so this must not count as the user moving it: that would write
+	the rounded value to the driver and make it the baseline, of every
+	monitor with "Affect all" checked */
+static void vibrance_scale_sync(void)
+{
+	monitor_config_t *monitor_conf = &gdisplay.monitors_conf[user_data.dropd_def_mon];
+
+	g_signal_handlers_block_by_func(pwidgets.pvscale, vibrance_scale_callback, &pwidgets);
+	gtk_range_set_value(GTK_RANGE(pwidgets.pvscale),
+			dv_value_to_percentage(monitor_conf->vibrance_level, monitor_conf));
+	g_signal_handlers_unblock_by_func(pwidgets.pvscale, vibrance_scale_callback, &pwidgets);
+}
+
 /* Called when the "Affect all" button is pressed.
  * Note that monitors vibrance won't change live after button is checked.
  */
@@ -73,32 +85,41 @@ static void __always_inline affect_all_callback(GtkCheckButton *check_btn)
 }
 
 /* This function is called when the selects a monitor to affect;
-	It fetches the vibrance level of this mon and updates the scale accordingly */
+	It takes the baseline vibrance of this mon and updates the scale accordingly,
+	without a round trip to the driver */
 static void dropdown_selected_callback(GtkDropDown *self)
 {
-	int dv;
-
 	user_data.dropd_def_mon = gtk_drop_down_get_selected(self);
-	get_monitor_vibrance(&dv, gdisplay.monitors_conf[user_data.dropd_def_mon].dpyId);
-	dv = dv_value_to_percentage(dv, &gdisplay.monitors_conf[user_data.dropd_def_mon]);
-	gtk_range_set_value(GTK_RANGE(pwidgets.pvscale), dv);
+	vibrance_scale_sync();
 }
 
 static void pid_entry_submit_callback(GtkEntry *self, GtkEntry *vib_level)
 {
-	char *spid, *vlevel;
+	char *spid, *vlevel, *tooltip;
 
 	/* Get the user supplied process ID */
 	spid = (char *)gtk_editable_get_text(GTK_EDITABLE(self));
 	vlevel = (char *)gtk_editable_get_text(GTK_EDITABLE(vib_level));
 
-	/* This function may fail if the key already exists,
-		or update the old value of the _same_ key with the new supplied value. */
-	glib_insert_new_value(spid, vlevel);
+	/* Replaces the level if the process already has a rule. Fails if the
+		level is empty, or if the process doesn't exist (anymore) or
+		can't be watched for its exit. */
+	if (!glib_insert_new_value(gdisplay.rules, spid, vlevel)) {
+		gtk_widget_add_css_class(GTK_WIDGET(self), "error");
+		gtk_widget_set_tooltip_text(GTK_WIDGET(self), "No such process, or no level given");
+		return;
+	}
+
+	/* Rules of exited processes are dropped on their own, tell how many */
+	tooltip = g_strdup_printf("%u rule(s) of exited processes removed",
+					glib_pid_evictions(gdisplay.rules));
+	gtk_widget_remove_css_class(GTK_WIDGET(self), "error");
+	gtk_widget_set_tooltip_text(GTK_WIDGET(self), tooltip);
+	g_free(tooltip);
 
 	/* DEBUG DEBUG DEBUG (: */
 	#ifdef DEBUG
-	print_table_contents();
+	print_table_contents(gdisplay.rules);
 	#endif
 }
 
@@ -137,23 +158,18 @@ static void do_gtk_widgets_init_values(GtkWidget *window, GtkBuilder *build,
 	const char *credit_text =
 		"<a href=\"https://github.com/qodroi\" title=\"&lt;i&gt;Github&lt;/i&gt; Profile\">"
 		"Made by Roi</a>";
-	gint current_vib;
 
 	pwidgets.pcbox = checkbtn;
 	pwidgets.pvscale = vscale;
 
-	get_monitor_vibrance(&current_vib,
-			gdisplay.monitors_conf[user_data.dropd_def_mon].dpyId);
-	gtk_range_set_value(GTK_RANGE(pwidgets.pvscale),
-	 		dv_value_to_percentage(current_vib,
-			&gdisplay.monitors_conf[user_data.dropd_def_mon]));
+	vibrance_scale_sync();
 
 	gtk_scale_add_mark(GTK_SCALE(vscale), 50, GTK_POS_TOP,
 		 "<span font_size='small' stretch='ultracondensed'>Vibrance Level</span>");
 	gtk_label_set_markup(GTK_LABEL(credit), credit_text);
 	gtk_image_set_pixel_size(GTK_IMAGE(nvi_image), 170);
 
-	gthread_p = g_thread_new("vib_app_hook_thread", vib_app_hook_thread_start, NULL);
+	gthread_p = g_thread_new("vib_app_hook_thread", vib_app_hook_thread_start, &gdisplay);
 	gtk_widget_show(window);
 }
 
@@ -182,7 +198,7 @@ static void gtk_activate(GtkApplication *app, gpointer data)
 			gdk_monitor_get_model(g_list_model_get_item(user_data.glist_monitors, mon)); 
 	}
 
-	glib_new_hash_table();
+	gdisplay.rules = glib_new_hash_table();
 
 	/* load GtkWidget objects created by the external XML file */
 	build = gtk_builder_new_from_file("gtkui.xml");
@@ -245,8 +261,11 @@ int do_init_gtk_window(
 	gdisplay.dpy = NULL;
 	g_thread_unref(gthread_p);
 	g_object_unref(app);
-	free(gdisplay.monitors_conf);
+	device_display_config_free(&gdisplay);
+	glib_free_hash_table(gdisplay.rules);
+	gdisplay.rules = NULL;
 	pthread_spin_unlock(&gdisplay.lock);
+	vhook_wake(&gdisplay); /* Sees @dpy is gone and quits */
 
 	return status;
 }
@@ -16,6 +16,9 @@
  */
 
 #include <X11/Xatom.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <errno.h>
 
 #include "vibrancelui.h"
 #include "ghashtable.h"
@@ -34,46 +37,60 @@ static __always_inline void check_function_status(int status, Window window)
 }
 
 /* This function takes a graphical window id (e.g. terminal window id) 
-	and compares its width and height against the current monitor width and height
-	in order to determine if this application is in full-screen mode.
+	and compares its width and height against the width and height of the monitors
+	of @nv_screen in order to determine if this application is in full-screen mode.
 */
-static Status is_window_full_screen(unsigned long window_id)
+static Status is_window_full_screen(global_display_t *gd, nv_screen_t *nv_screen,
+				unsigned long window_id)
 {
 	XWindowAttributes win_attributes;
 	Status status;
+	int mon;
 
-	status = XGetWindowAttributes(gdisplay.dpy, (Window)window_id, &win_attributes);
-	if (status == BadWindow) {
+	/* Zero if the window is gone, e.g. destroyed before we got to its focus */
+	status = XGetWindowAttributes(gd->dpy, (Window)window_id, &win_attributes);
+	if (!status) {
 		DEBUG_PRINTF("Couldn't fetch window (%lx) properties (status code: %d)\n",
 				 window_id, status);
 		return false;
 	}
 	
-	if (win_attributes.width == gdisplay.monitors_conf[user_data.dropd_def_mon].width
-				 && win_attributes.height == gdisplay.monitors_conf[user_data.dropd_def_mon].height)
-		return true;
+	for (mon = 0; mon < nv_screen->ndisplays; mon++) {
+		if (win_attributes.width == nv_screen->monitors_conf[mon].width
+					 && win_attributes.height == nv_screen->monitors_conf[mon].height)
+			return true;
+	}
 	return false;
 }
 
-static unsigned char *get_string_property(const char *property_name, Window window)
+static unsigned char *get_string_property(global_display_t *gd, const char *property_name,
+				Window window)
 {
 	Atom actual_type, filter_atom;
 	int actual_format, status;
 	unsigned long nitems, bytes_after;
 
-	filter_atom = XInternAtom(gdisplay.dpy, property_name, True);
-	status = XGetWindowProperty(gdisplay.dpy, window, filter_atom, 0, MAXSTR, False, AnyPropertyType,
+	/* Only the last fetched property is kept around */
+	if (prop) {
+		XFree(prop);
+		prop = NULL;
+	}
+
+	filter_atom = XInternAtom(gd->dpy, property_name, True);
+	if (filter_atom == None)
+		return NULL; /* Nobody ever set such a property */
+	status = XGetWindowProperty(gd->dpy, window, filter_atom, 0, MAXSTR, False, AnyPropertyType,
 								&actual_type, &actual_format, &nitems, &bytes_after, &prop);
 	check_function_status(status, window);
 
 	return prop;
 }
 
-static unsigned long __always_inline get_long_property(const char *property_name, Window window)
+static unsigned long __always_inline get_long_property(global_display_t *gd, const char *property_name, Window window)
 {
 	unsigned long long_property;
 
-	get_string_property(property_name, window);
+	get_string_property(gd, property_name, window);
 
 	if (prop == NULL)
 		return false;
@@ -83,104 +100,312 @@ static unsigned long __always_inline get_long_property(const char *property_name
 	return long_property;
 }
 
-static __always_inline const unsigned char *get_window_name(unsigned long active_window)
+static __always_inline const unsigned char *get_window_name(global_display_t *gd, unsigned long active_window)
 {
-	return get_string_property("WM_CLASS", active_window);
+	return get_string_property(gd, "WM_CLASS", active_window);
 }
 
-static unsigned long __always_inline get_active_window_pid(unsigned long active_window)
+static unsigned long __always_inline get_active_window_pid(global_display_t *gd, unsigned long active_window)
 {
-	return get_long_property("_NET_WM_PID", active_window);
+	return get_long_property(gd, "_NET_WM_PID", active_window);
 }
 
-static unsigned long __always_inline get_active_window_id(Window root_window)
+static unsigned long __always_inline get_active_window_id(global_display_t *gd, Window root_window)
 {
-	return get_long_property("_NET_ACTIVE_WINDOW", root_window);
+	return get_long_property(gd, "_NET_ACTIVE_WINDOW", root_window);
 }
 
-static bool __always_inline is_window_type_desktop(unsigned long active_window)
+static bool __always_inline is_window_type_desktop(global_display_t *gd, unsigned long active_window)
 {
-	return get_long_property("_NET_WM_WINDOW_TYPE", active_window) ==
+	return get_long_property(gd, "_NET_WM_WINDOW_TYPE", active_window) ==
 			_NET_WM_WINDOW_TYPE_DESKTOP ? true : false;
 }
 
-static bool __attribute__((hot))
-handle_active_window(unsigned long active_window)
+/* Resolve the window rules for @window once, and cache the result until
+	one of the properties they match on changes (see vhook_dispatch_pending).
+	Only windows whose result hangs on their title or role get listened to. */
+static const window_rule_t *window_rule_of(global_display_t *gd, unsigned long window)
+{
+	const window_rule_t *rule;
+	char *instance, *title, *role;
+
+	if (glib_window_rules_count(gd->rules) == 0)
+		return NULL;
+	if (glib_window_cache_lookup(gd->rules, window, &rule))
+		return rule;
+
+	/* WM_CLASS holds "instance\0class\0", the instance comes first */
+	instance = g_strdup((char *)get_string_property(gd, "WM_CLASS", window));
+	title = g_strdup((char *)get_string_property(gd, "_NET_WM_NAME", window));
+	if (title == NULL)
+		title = g_strdup((char *)get_string_property(gd, "WM_NAME", window));
+	role = g_strdup((char *)get_string_property(gd, "WM_WINDOW_ROLE", window));
+
+	rule = glib_match_window_rule(gd->rules, instance, title, role);
+	glib_window_cache_store(gd->rules, window, rule); /* No match is cached too */
+
+	/* A rename can only change the result if a title or role rule is in
+		the way. Selecting on a window that's gone already fails with
+		BadWindow, which vhook_x_error_handler() ignores */
+	if (glib_window_rule_depends_on_title(gd->rules, rule))
+		XSelectInput(gd->dpy, window, PropertyChangeMask);
+
+	g_free(instance);
+	g_free(title);
+	g_free(role);
+
+	return rule;
+}
+
+/* Find the settings the rules give to @active_window, false if none
+	applies. Window rules take precedence over PID rules. */
+static bool active_window_rule(global_display_t *gd, nv_screen_t *nv_screen,
+				unsigned long active_window, display_settings_t *settings)
 {
+	const window_rule_t *rule;
 	unsigned long window_pid;
 	char pid_buf[21 + 1] = { 0 };
-	const char *dv_level_for_pid;
-
-	__reset_monitor_vibrance(0, true); /* Focus was changed.
-				Reset all monitors digital vibrance */
 
 	/* Did we focus on our desktop? */
-	if (is_window_type_desktop(active_window))
+	if (is_window_type_desktop(gd, active_window))
 		return false;
 
-	/* Note that @active_window is actually just the Window's ID */
-	window_pid = get_active_window_pid(active_window);
-	if (window_pid == 0)
-		return false;
+	rule = window_rule_of(gd, active_window);
+	if (rule) {
+		*settings = rule->settings;
+	} else {
+		/* Note that @active_window is actually just the Window's ID */
+		window_pid = get_active_window_pid(gd, active_window);
+		if (window_pid == 0)
+			return false;
 
 #ifdef DEBUG
-	DEBUG_PRINTF("%s %lx %lu\n", get_window_name(active_window), active_window, window_pid);
+		DEBUG_PRINTF("%s %lx %lu\n", get_window_name(gd, active_window), active_window, window_pid);
 #endif
 
-	/* FIXME: Currently we set vibrance on _all_ monitors;
-		Find the monitor that the application was opened on */
-	
-	snprintf(pid_buf, sizeof(pid_buf), "%lu", window_pid);
+		snprintf(pid_buf, sizeof(pid_buf), "%lu", window_pid);
+
+		if (!fetch_settings_for_spid_ht(gd->rules, pid_buf, settings))
+			return false;
+	}
 
-	if ((dv_level_for_pid = fetch_vlevel_for_spid_ht(pid_buf)) == NULL)
+	return is_window_full_screen(gd, nv_screen, active_window);
+}
+
+/* Focus was changed on @nv_screen; only the displays of that screen are
+	affected, other screens keep whatever their own focus asked for. */
+static bool __attribute__((hot))
+handle_active_window(global_display_t *gd, nv_screen_t *nv_screen,
+				unsigned long active_window)
+{
+	display_profile_t profile = DISPLAY_PROFILE(gd->ndisplays);
+	display_settings_t settings;
+	int mon, first_mon;
+	bool ruled;
+
+	nv_screen->active_window = active_window;
+	ruled = active_window_rule(gd, nv_screen, active_window, &settings);
+
+	/* FIXME: Currently we set the profile on _all_ monitors of the screen;
+		Find the monitor that the application was opened on */
+	first_mon = nv_screen->monitors_conf - gd->monitors_conf;
+	if (!ruled) {
+		/* Back to the user's baseline */
+		__reset_monitor_vibrance(gd, first_mon, nv_screen->ndisplays);
 		return false;
-	if (is_window_full_screen(active_window)) 
-	{
-		int _v = 0;
-	
-		_v = strtol(dv_level_for_pid, (char **)NULL, 10);
-		_v = dv_percentage_to_value(_v > 100 ? 100 : _v, NULL);
+	}
+
+	for (mon = 0; mon < nv_screen->ndisplays; mon++)
+		display_profile_set_rule(gd, &profile, first_mon + mon, &settings);
+	apply_display_profile(gd, &profile);
+
+	return true;
+}
+
+/* Map a root window back to the NVIDIA X screen it belongs to */
+static nv_screen_t *nv_screen_of_root(global_display_t *gd, Window root)
+{
+	int scr_index;
 
-		set_monitor_vibrance(0, _v, true); /* FIXME: Change "true" to current primary monitor */
-		return true;
+	for (scr_index = 0; scr_index < gd->nscreens; scr_index++) {
+		if (gd->screens[scr_index].root == root)
+			return &gd->screens[scr_index];
 	}
-	
-	return false;
+
+	return NULL;
+}
+
+/* Screen whose focused window is @window, if any */
+static nv_screen_t *nv_screen_of_active_window(global_display_t *gd, Window window)
+{
+	int scr_index;
+
+	for (scr_index = 0; scr_index < gd->nscreens; scr_index++) {
+		if (gd->screens[scr_index].active_window == window)
+			return &gd->screens[scr_index];
+	}
+
+	return NULL;
+}
+
+/* Forget the windows that were destroyed, which the window manager drops
+	off the _NET_CLIENT_LIST of their root: cheaper than selecting
+	StructureNotify on every window, which floods us with ConfigureNotify */
+static void prune_window_cache(global_display_t *gd)
+{
+	Atom actual_type;
+	int actual_format, scr_index;
+	unsigned long nitems, bytes_after, nclients = 0, *clients = NULL;
+	unsigned char *list;
+
+	for (scr_index = 0; scr_index < gd->nscreens; scr_index++) {
+		if (XGetWindowProperty(gd->dpy, gd->screens[scr_index].root, gd->net_client_list,
+					0, MAXSTR, False, XA_WINDOW, &actual_type, &actual_format,
+					&nitems, &bytes_after, &list) != Success || list == NULL)
+			continue;
+
+		/* 32 bit items come back as longs */
+		clients = g_realloc(clients, (nclients + nitems) * sizeof(*clients));
+		memcpy(&clients[nclients], list, nitems * sizeof(*clients));
+		nclients += nitems;
+		XFree(list);
+	}
+
+	glib_window_cache_retain(gd->rules, clients, nclients);
+	g_free(clients);
+}
+
+/* Does a change of @atom affect what window rules match on? */
+static bool is_window_rule_property(global_display_t *gd, Atom atom)
+{
+	return atom == XA_WM_CLASS || atom == XA_WM_NAME ||
+			atom == gd->net_wm_name || atom == gd->wm_window_role;
+}
+
+/* Errors come in asynchronously, long after the request that caused them,
+	and Xlib's default handler exits. A window may be destroyed anytime
+	between us learning its ID and using it, so BadWindow is expected;
+	anything else is only logged. */
+static int vhook_x_error_handler(Display *dpy, XErrorEvent *e)
+{
+	char text[128];
+
+	if (e->error_code == BadWindow)
+		return 0;
+
+	XGetErrorText(dpy, e->error_code, text, sizeof(text));
+	fprintf(stderr, "X error on %s: %s (request %d.%d, resource 0x%lx)\n",
+		DisplayString(dpy), text, e->request_code, e->minor_code, e->resourceid);
+	return 0;
+}
+
+/* Process wide, covers every connection the hook uses */
+void vhook_install_error_handler(void)
+{
+	XSetErrorHandler(vhook_x_error_handler);
 }
 
-void *vib_app_hook_thread_start(void *)
+/* Listen to the root window of every NVIDIA X screen of @gd. All screens
+	share the one connection, so a single loop serves all of them. */
+void vhook_display_init(global_display_t *gd)
+{
+	int scr_index;
+
+	for (scr_index = 0; scr_index < gd->nscreens; scr_index++)
+		XSelectInput(gd->dpy, gd->screens[scr_index].root, PropertyChangeMask);
+	gd->net_active_window = XInternAtom(gd->dpy, "_NET_ACTIVE_WINDOW", False);
+	gd->net_wm_name = XInternAtom(gd->dpy, "_NET_WM_NAME", False);
+	gd->wm_window_role = XInternAtom(gd->dpy, "WM_WINDOW_ROLE", False);
+	gd->net_client_list = XInternAtom(gd->dpy, "_NET_CLIENT_LIST", False);
+}
+
+/* Handle every event queued on the connection of @gd, without blocking */
+void vhook_dispatch_pending(global_display_t *gd)
 {
-	Window w;
 	XEvent e;
-	unsigned long active_window;    
+	nv_screen_t *nv_screen;
+	unsigned long active_window;
 
-	w = DefaultRootWindow(gdisplay.dpy);
-	if (w == 0)
-		return NULL;
+	while (XPending(gd->dpy)) {
+		XNextEvent(gd->dpy, &e);
+		if (e.type == PropertyNotify && e.xproperty.atom == gd->net_active_window)
+		{
+			nv_screen = nv_screen_of_root(gd, e.xproperty.window);
+			if (nv_screen == NULL)
+				continue;
+			active_window = get_active_window_id(gd, nv_screen->root);
+			handle_active_window(gd, nv_screen, active_window);
+		}
+		else if (e.type == PropertyNotify && e.xproperty.atom == gd->net_client_list)
+		{
+			if (glib_window_rules_count(gd->rules))
+				prune_window_cache(gd);
+		}
+		else if (e.type == PropertyNotify && is_window_rule_property(gd, e.xproperty.atom))
+		{
+			/* e.g. a browser tab switched to a video; re-resolve the window,
+				right away if it's the one in focus */
+			glib_window_cache_invalidate(gd->rules, e.xproperty.window);
+			nv_screen = nv_screen_of_active_window(gd, e.xproperty.window);
+			if (nv_screen)
+				handle_active_window(gd, nv_screen, e.xproperty.window);
+		}
+	}
+}
 
-	XSelectInput(gdisplay.dpy, w, PropertyChangeMask);
+/* Wake the GUI's hook thread up after X calls made from the GUI thread:
+	their XFlush may have read events off the connection into Xlib's
+	queue, where polling the connection doesn't see them */
+void vhook_wake(global_display_t *gd)
+{
+	eventfd_write(gd->wakefd, 1);
+}
 
-	/* Use spinlock to prevent TOCTOU race condition with @gdisplay.dpy being null
+void *vib_app_hook_thread_start(void *data)
+{
+	global_display_t *gd = data;
+	struct pollfd pfds[HOOK_POLL_COUNT] = { 0 };
+	eventfd_t wakeups;
+
+	/* The GUI may already be moving the slider */
+	pthread_spin_lock(&gd->lock);
+	vhook_display_init(gd);
+	pthread_spin_unlock(&gd->lock);
+
+	/* Wait on both the X connection and the pidfds of the tracked
+		processes, so rules are evicted as soon as their process exits. */
+	pfds[HOOK_POLL_X].fd = ConnectionNumber(gd->dpy);
+	pfds[HOOK_POLL_X].events = POLLIN;
+	pfds[HOOK_POLL_RULES].fd = glib_rules_pollfd(gd->rules);
+	pfds[HOOK_POLL_RULES].events = POLLIN;
+	pfds[HOOK_POLL_WAKE].fd = gd->wakefd;
+	pfds[HOOK_POLL_WAKE].events = POLLIN;
+
+	/* Use spinlock to prevent TOCTOU race condition with @gd->dpy being null
 		after application close, with this function possibly runs one last time after close.
 		Though quite heavy, that's the only solution I found.
 
-		I think we could use atomic operations on @gdisplay.dpy, but I need to figure out
+		It also keeps the GUI thread out while we dispatch: both write the
+		driver and the attribute cache, and read the baseline the slider sets.
+
+		I think we could use atomic operations on @gd->dpy, but I need to figure out
 		how to implement it correctly.
 	*/
 	for (;;) {
-		/* Expect positive return value,
-			 as until close no one wil take the lock. */
-		if (__builtin_expect(pthread_spin_trylock(&gdisplay.lock), 0))
+		pthread_spin_lock(&gd->lock);
+		if (__builtin_expect(gd->dpy == NULL, 0)) {
+			pthread_spin_unlock(&gd->lock);
 			break;
-		XNextEvent(gdisplay.dpy, &e);
-		if (e.type == PropertyNotify)
-		{
-			if (!strcmp(XGetAtomName(gdisplay.dpy, e.xproperty.atom), "_NET_ACTIVE_WINDOW")) {
-				active_window = get_active_window_id(w);
-				handle_active_window(active_window);
-			}
 		}
-		pthread_spin_unlock(&gdisplay.lock);
+		if (pfds[HOOK_POLL_RULES].revents & POLLIN)
+			glib_reap_exited_pids(gd->rules);
+		if (pfds[HOOK_POLL_WAKE].revents & POLLIN)
+			eventfd_read(gd->wakefd, &wakeups);
+		vhook_dispatch_pending(gd);
+		pthread_spin_unlock(&gd->lock);
+
+		if (poll(pfds, HOOK_POLL_COUNT, -1) < 0 && errno != EINTR)
+			break;
 	}
 
 	return NULL;
@@ -18,153 +18,386 @@
  */
 
 
-#include <X11/extensions/Xinerama.h>
+#include <X11/extensions/Xrandr.h>
+#include <sys/eventfd.h>
 
 #include "vibrancelui.h"
+#include "vhook.h"
+#include "vdaemon.h"
+#include "vapply.h"
 
 global_display_t gdisplay = { 0 };
 
-/* GetNvXScreen doesn't seem to get exported by any of the shared
- * libraries linked to our binary, so we redefine it as weak.
- */
-int __attribute__((weak)) GetNvXScreen(Display *dpy)
+/* NV-CONTROL attribute for every enum display_attribute */
+static const unsigned int nv_display_attributes[DATTR_COUNT] = {
+    [DATTR_DIGITAL_VIBRANCE] = NV_CTRL_DIGITAL_VIBRANCE,
+    [DATTR_IMAGE_SHARPENING] = NV_CTRL_IMAGE_SHARPENING,
+    [DATTR_COLOR_RANGE] = NV_CTRL_COLOR_RANGE,
+    [DATTR_COLOR_SPACE] = NV_CTRL_COLOR_SPACE,
+};
+
+/* Restore the @nmonitors monitors from @first_monitor to the user's
+    baseline, digital vibrance and every other attribute, only writing
+    to the displays that aren't there already. */
+void __reset_monitor_vibrance(global_display_t *gd, int first_monitor, int nmonitors)
 {
-    int def_scn, screen;
+    display_profile_t profile = DISPLAY_PROFILE(gd->ndisplays);
+    int mon;
 
-    def_scn = DefaultScreen(dpy);
+    for (mon = first_monitor; mon < first_monitor + nmonitors && mon < gd->ndisplays; mon++)
+        display_profile_set_rule(gd, &profile, mon, NULL);
+    apply_display_profile(gd, &profile);
+}
 
-    if (XNVCTRLIsNvScreen(dpy, def_scn))
-        return def_scn;
+/* Set the digital vibrance of the specified @monitor(s) to @percentage,
+     which becomes their baseline. Every monitor converts it through its
+     own calibration table, and all of them are written with one flush.
+     The caller holds @gd->lock if the hook thread shares @gd */
+void
+set_monitor_vibrance(global_display_t *gd, int monitor_number, int percentage,
+                        bool affect_all)
+{
+    display_profile_t profile = DISPLAY_PROFILE(gd->ndisplays);
+    monitor_config_t *monitor_conf;
+    int mon;
 
-    for (screen = 0; screen < ScreenCount(dpy); screen++) {
-        if (XNVCTRLIsNvScreen(dpy, screen)) {
-            DEBUG_PRINTF("Default X screen %d is not an NVIDIA X screen.  "
-                   "Using X screen %d instead.\n",
-                   def_scn, screen);
-            return screen;
-        }
+    if (percentage < 0 || percentage > 100)
+        return;
+
+    /* Displays of every NVIDIA X screen are part of @monitors_conf */
+    for (mon = 0; mon < gd->ndisplays; mon++) {
+        if (!affect_all && mon != monitor_number)
+            continue;
+
+        monitor_conf = &gd->monitors_conf[mon];
+        monitor_conf->vibrance_level = dv_percentage_to_value(percentage, monitor_conf);
+        display_profile_set(&profile, mon, DATTR_DIGITAL_VIBRANCE,
+                    monitor_conf->vibrance_level);
     }
 
-    DIE("Unable to find any NVIDIA X screens; aborting.\n");
+    apply_display_profile(gd, &profile);
 }
 
-/* Query the current applied digital vibrance for the given @dpyId,
- * and store the return value in @ret_vibrance
- */
-bool
-get_monitor_vibrance(int *ret_vibrance, int dpyId)
+/* Check @value against what the driver reported as valid for the attribute */
+static bool attribute_value_is_valid(const attr_valid_values_t *valid, int value)
 {
-    return XNVCTRLQueryTargetAttribute(gdisplay.dpy, NV_CTRL_TARGET_TYPE_DISPLAY,
-        dpyId, 0, NV_CTRL_DIGITAL_VIBRANCE, ret_vibrance);
+    switch (valid->type) {
+    case ATTRIBUTE_TYPE_RANGE:
+        return valid->min <= value && value <= valid->max;
+    case ATTRIBUTE_TYPE_INT_BITS:
+        return value >= 0 && value < 32 && (valid->bits & (1U << value));
+    case ATTRIBUTE_TYPE_BOOL:
+        return value == 0 || value == 1;
+    case ATTRIBUTE_TYPE_INTEGER:
+        return true;
+    default:
+        return false; /* Not supported by this display */
+    }
 }
 
-/* Clear @monitor(s) digital vibrance */
-void __always_inline __reset_monitor_vibrance(int monitor_number, bool affect_all)
+/* Record @value for @attr of @monitor_number in the profile */
+void display_profile_set(display_profile_t *profile, int monitor_number,
+                        enum display_attribute attr, int value)
 {
-    set_monitor_vibrance(monitor_number, 0, affect_all);
+    if (monitor_number < 0 || monitor_number >= profile->ndisplays)
+        return;
+
+    profile->mon[monitor_number].mask |= 1U << attr;
+    profile->mon[monitor_number].value[attr] = value;
 }
 
-/* Set the digital vibrance of the specified @monitor(s)
-     to the target @vibrance_level value */
-void
-set_monitor_vibrance(int monitor_number, int vibrance_level,
-                        bool affect_all)
+/* Record what @settings of a rule ask for on @monitor_number, and the
+    user's baseline for every attribute they leave alone. NULL @settings
+    (no rule) restores the baseline of everything. */
+void display_profile_set_rule(global_display_t *gd, display_profile_t *profile,
+                        int monitor_number, const display_settings_t *settings)
+{
+    monitor_config_t *monitor_conf = &gd->monitors_conf[monitor_number];
+    int attr, value;
+
+    for (attr = 0; attr < DATTR_COUNT; attr++) {
+        if (settings == NULL || !(settings->mask & (1U << attr)))
+            value = attr == DATTR_DIGITAL_VIBRANCE ? monitor_conf->vibrance_level :
+                        monitor_conf->attr_baseline[attr];
+        else if (attr == DATTR_DIGITAL_VIBRANCE) /* Through the monitor's own calibration table */
+            value = dv_percentage_to_value(settings->value[attr], monitor_conf);
+        else
+            value = settings->value[attr];
+
+        display_profile_set(profile, monitor_number, attr, value);
+    }
+}
+
+/* Apply every attribute of @profile that differs from the cached driver
+    state, in one request sequence followed by a single flush, so a profile
+    switch doesn't show up on screen one attribute at a time.
+    Returns the number of attributes written. */
+int apply_display_profile(global_display_t *gd, const display_profile_t *profile)
 {
-    monitor_config_t monitor_conf = gdisplay.monitors_conf[monitor_number];
-    int dpyid = 0; /* None of my monitors have dpyID of 0, but just in case. */
-
-   	/* 	Check if @vibrance_level is NOT within the acceptable range. 
-		NOTE: This relies on one monitor configuration, I assume they all
-		have the same min\max vibrance configuration.
-	*/
-   	if (!(monitor_conf.min_vibrance <= vibrance_level &&
-			vibrance_level <= monitor_conf.max_vibrance))
-		return;
-
-    do {
-        XNVCTRLSetTargetAttribute(gdisplay.dpy,
+    monitor_config_t *monitor_conf;
+    const display_settings_t *settings;
+    int mon, attr, written = 0;
+
+    for (mon = 0; mon < gd->ndisplays && mon < profile->ndisplays; mon++) {
+        monitor_conf = &gd->monitors_conf[mon];
+        settings = &profile->mon[mon];
+
+        for (attr = 0; attr < DATTR_COUNT; attr++) {
+            if (!(settings->mask & (1U << attr)))
+                continue;
+            if (settings->value[attr] == monitor_conf->attr_cache[attr])
+                continue;
+            if (!attribute_value_is_valid(&monitor_conf->valid[attr], settings->value[attr]))
+                continue;
+
+            XNVCTRLSetTargetAttribute(gd->dpy,
                                 NV_CTRL_TARGET_TYPE_DISPLAY,
-                                affect_all == false ? monitor_conf.dpyId : dpyid,
-                                0, /* Leave it zero */
-                                NV_CTRL_DIGITAL_VIBRANCE,
-                                vibrance_level);
-    } while (affect_all && dpyid++ <= user_data.nm);
-    XFlush(gdisplay.dpy);
+                                monitor_conf->dpyId,
+                                0,
+                                nv_display_attributes[attr],
+                                settings->value[attr]);
+            monitor_conf->attr_cache[attr] = settings->value[attr];
+            written++;
+        }
+    }
+
+    if (written)
+        XFlush(gd->dpy);
+
+    return written;
 }
 
-/* Query the valid range of vibrance level for the specified monitor */
-static int query_valid_vibrance_levels(monitor_config_t *monitor_conf, int dpyid)
+/* Query the valid values of @attr for the specified monitor, and if
+    @query_current its current value to seed the attribute cache */
+static int query_valid_attribute_values(global_display_t *gd, monitor_config_t *monitor_conf, int dpyid,
+                        enum display_attribute attr, bool query_current)
 {
     NVCTRLAttributeValidValuesRec valid_values;
+    attr_valid_values_t *valid = &monitor_conf->valid[attr];
     int ret;
 
-    ret = XNVCTRLQueryValidTargetAttributeValues(gdisplay.dpy,
+    ret = XNVCTRLQueryValidTargetAttributeValues(gd->dpy,
                 NV_CTRL_TARGET_TYPE_DISPLAY,
                 dpyid,
                 0,
-                NV_CTRL_DIGITAL_VIBRANCE,
+                nv_display_attributes[attr],
                 &valid_values);
     if (!ret)
+        return -1;
+
+    valid->type = valid_values.type;
+    if (valid_values.type == ATTRIBUTE_TYPE_RANGE) {
+        valid->min = valid_values.u.range.min;
+        valid->max = valid_values.u.range.max;
+    } else if (valid_values.type == ATTRIBUTE_TYPE_INT_BITS) {
+        valid->bits = valid_values.u.bits.ints;
+    }
+
+    if (!query_current)
+        monitor_conf->attr_cache[attr] = ATTR_VALUE_UNKNOWN;
+    else if (!XNVCTRLQueryTargetAttribute(gd->dpy, NV_CTRL_TARGET_TYPE_DISPLAY,
+                dpyid, 0, nv_display_attributes[attr], &monitor_conf->attr_cache[attr]))
+        valid->type = 0; /* Can't diff against an unknown value */
+    monitor_conf->attr_baseline[attr] = monitor_conf->attr_cache[attr];
+
+    return 0;
+}
+
+/* Query the valid range of vibrance level for the specified monitor */
+static int query_valid_vibrance_levels(global_display_t *gd, monitor_config_t *monitor_conf, int dpyid,
+                        bool query_current)
+{
+    int ret;
+
+    ret = query_valid_attribute_values(gd, monitor_conf, dpyid, DATTR_DIGITAL_VIBRANCE,
+                query_current);
+    if (ret)
         return ret;
-    if (valid_values.type != ATTRIBUTE_TYPE_RANGE)
+    if (monitor_conf->valid[DATTR_DIGITAL_VIBRANCE].type != ATTRIBUTE_TYPE_RANGE)
         return -1;
 
-    monitor_conf->min_vibrance = valid_values.u.range.min;
-    monitor_conf->max_vibrance = valid_values.u.range.max;
+    monitor_conf->min_vibrance = monitor_conf->valid[DATTR_DIGITAL_VIBRANCE].min;
+    monitor_conf->max_vibrance = monitor_conf->valid[DATTR_DIGITAL_VIBRANCE].max;
 
     return 0;
 }
 
-static void query_mon_height_and_width(monitor_config_t *monitor_conf, int scrn)
+/* Fetch the size of the display out of the RandR @monitors of its own X
+    screen, matched on the RandR output name the driver knows it by, or
+    else on its position @screen_mon on the screen. Falls back to the size
+    of the whole X screen. */
+static void query_mon_height_and_width(global_display_t *gd, monitor_config_t *monitor_conf,
+                        XRRMonitorInfo *monitors, int nmonitors, int screen_mon)
 {
-    XineramaScreenInfo *xine_scr;
-    int n_entries;
+    XRRMonitorInfo *monitor = NULL;
+    char *randr_name;
+    Atom name;
+    int i;
+
+    monitor_conf->height = DisplayHeight(gd->dpy, gd->screens[monitor_conf->screen].screen);
+    monitor_conf->width = DisplayWidth(gd->dpy, gd->screens[monitor_conf->screen].screen);
+
+    if (XNVCTRLQueryTargetStringAttribute(gd->dpy, NV_CTRL_TARGET_TYPE_DISPLAY,
+                monitor_conf->dpyId, 0, NV_CTRL_STRING_DISPLAY_NAME_RANDR, &randr_name)) {
+        name = XInternAtom(gd->dpy, randr_name, True);
+        for (i = 0; i < nmonitors && name != None; i++) {
+            if (monitors[i].name == name) {
+                monitor = &monitors[i];
+                break;
+            }
+        }
+        XFree(randr_name);
+    }
+    if (monitor == NULL && screen_mon < nmonitors)
+        monitor = &monitors[screen_mon];
 
-    xine_scr = XineramaQueryScreens(gdisplay.dpy, &n_entries);
-    if (xine_scr == NULL)
-        return;
-    
-    monitor_conf->height = xine_scr[scrn].height;
-    monitor_conf->width = xine_scr[scrn].width;
+    if (monitor) {
+        monitor_conf->height = monitor->height;
+        monitor_conf->width = monitor->width;
+    }
+}
 
-    XFree(xine_scr);
+static void monitor_config_init(global_display_t *gd, monitor_config_t *monitor_conf, int scr_index,
+                        int dpyid, XRRMonitorInfo *monitors, int nmonitors, int screen_mon,
+                        const dv_curve_t *curve)
+{
+    int attr;
+
+    monitor_conf->screen = scr_index;
+    monitor_conf->dpyId = dpyid;
+    query_valid_vibrance_levels(gd, monitor_conf, dpyid, true);
+    for (attr = DATTR_DIGITAL_VIBRANCE + 1; attr < DATTR_COUNT; attr++)
+        query_valid_attribute_values(gd, monitor_conf, dpyid, attr, true);
+    /* Already read along with the valid values */
+    monitor_conf->vibrance_level = monitor_conf->attr_cache[DATTR_DIGITAL_VIBRANCE];
+    query_mon_height_and_width(gd, monitor_conf, monitors, nmonitors, screen_mon);
+
+    if (dv_lut_build(&monitor_conf->lut, monitor_conf->min_vibrance,
+                monitor_conf->max_vibrance, curve)) {
+        /* The driver didn't report a usable range for this monitor */
+        monitor_conf->min_vibrance = DEFAULT_MIN_VIBRANCE_LEVEL;
+        monitor_conf->max_vibrance = DEFAULT_MAX_VIBRANCE_LEVEL;
+        if (dv_lut_build(&monitor_conf->lut, monitor_conf->min_vibrance,
+                    monitor_conf->max_vibrance, curve))
+            DIE("Failed to allocate memory for internal structure\n");
+    }
+}
+
+/* Bare minimum to convert and apply digital vibrance on a single display,
+    for one-shot use: no screen enumeration nor the other attributes, and
+    no current value either, it gets written whatever it is */
+int monitor_config_init_vibrance(global_display_t *gd, monitor_config_t *monitor_conf,
+                        int dpyid, const dv_curve_t *curve)
+{
+    monitor_conf->dpyId = dpyid;
+    if (query_valid_vibrance_levels(gd, monitor_conf, dpyid, false))
+        return -1;
+
+    return dv_lut_build(&monitor_conf->lut, monitor_conf->min_vibrance,
+                monitor_conf->max_vibrance, curve);
 }
 
-/* Initalize display configuration and data on program launch */
-static int device_display_config_init(int nvscreen)
+/* Initalize display configuration and data on program launch.
+    Every NVIDIA X screen is enumerated (one per GPU, or several per GPU
+    without Xinerama), and its displays are laid out contiguously in
+    @gd->monitors_conf so each screen owns a slice of it. */
+int device_display_config_init(global_display_t *gd)
 {
-    int dpyid, mon_index;
+    int screen, scr_index, mon_index, nmonitors, i;
+    XRRMonitorInfo *monitors;
+    nv_screen_t *nv_screen;
+    dv_curve_t curve;
 
-    XNVCTRLQueryTargetBinaryData(gdisplay.dpy,
+    /* Optional calibration curve shared by all monitors, see dv_curve_parse() */
+    if (dv_curve_parse(getenv("VIBRANCELUI_CURVE"), &curve))
+        fprintf(stderr, "Ignoring malformed VIBRANCELUI_CURVE, using a linear curve\n");
+
+    gd->screens = calloc(ScreenCount(gd->dpy), sizeof(*gd->screens));
+    if (gd->screens == NULL)
+        DIE("Failed to allocate memory for internal structure\n");
+
+    for (screen = 0; screen < ScreenCount(gd->dpy); screen++) {
+        if (!XNVCTRLIsNvScreen(gd->dpy, screen))
+            continue;
+
+        nv_screen = &gd->screens[gd->nscreens];
+        if (!XNVCTRLQueryTargetBinaryData(gd->dpy,
                                 NV_CTRL_TARGET_TYPE_X_SCREEN,
-                                nvscreen,
+                                screen,
                                 0,
                                 NV_CTRL_BINARY_DATA_DISPLAYS_ENABLED_ON_XSCREEN,
-                                (unsigned char **)&gdisplay.data,
-                                NULL);
-    gdisplay.ndisplays = gdisplay.data[0];
+                                (unsigned char **)&nv_screen->data,
+                                NULL))
+            continue;
+
+        nv_screen->screen = screen;
+        nv_screen->root = RootWindow(gd->dpy, screen);
+        nv_screen->ndisplays = nv_screen->data[0];
+        gd->ndisplays += nv_screen->ndisplays;
+        gd->nscreens++;
+    }
+
+    if (gd->nscreens == 0) {
+        free(gd->screens);
+        gd->screens = NULL;
+        return -1; /* Unable to find any NVIDIA X screens */
+    }
 
-    gdisplay.monitors_conf = calloc(sizeof(*gdisplay.monitors_conf) *
-                 gdisplay.ndisplays, sizeof(*gdisplay.monitors_conf));
-    if (gdisplay.monitors_conf == NULL)
+    gd->monitors_conf = calloc(gd->ndisplays, sizeof(*gd->monitors_conf));
+    if (gd->monitors_conf == NULL)
         DIE("Failed to allocate memory for internal structure\n");
 
-    for (dpyid = 1, mon_index = 0; dpyid <= gdisplay.ndisplays; dpyid++, mon_index++) 
-    {
-        get_monitor_vibrance(&gdisplay.monitors_conf[mon_index].vibrance_level, dpyid);
-        gdisplay.monitors_conf[mon_index].dpyId = dpyid;
-        query_valid_vibrance_levels(&gdisplay.monitors_conf[mon_index], dpyid);
-        query_mon_height_and_width(&gdisplay.monitors_conf[mon_index], mon_index);
+    for (scr_index = 0, mon_index = 0; scr_index < gd->nscreens; scr_index++) {
+        nv_screen = &gd->screens[scr_index];
+        nv_screen->monitors_conf = &gd->monitors_conf[mon_index];
+
+        /* Geometry of the monitors of this screen only */
+        monitors = XRRGetMonitors(gd->dpy, nv_screen->root, True, &nmonitors);
+        if (monitors == NULL)
+            nmonitors = 0;
+
+        /* @data holds the count followed by the display target IDs */
+        for (i = 0; i < nv_screen->ndisplays; i++, mon_index++)
+            monitor_config_init(gd, &gd->monitors_conf[mon_index], scr_index,
+                        nv_screen->data[i + 1], monitors, nmonitors, i, &curve);
+
+        if (monitors)
+            XRRFreeMonitors(monitors);
     }
 
     return 0;
 }
 
+/* Release everything device_display_config_init() allocated */
+void device_display_config_free(global_display_t *gd)
+{
+    int mon_index, scr_index;
+
+    for (mon_index = 0; mon_index < gd->ndisplays; mon_index++)
+        dv_lut_free(&gd->monitors_conf[mon_index].lut);
+    free(gd->monitors_conf);
+    gd->monitors_conf = NULL;
+
+    for (scr_index = 0; scr_index < gd->nscreens; scr_index++)
+        XFree(gd->screens[scr_index].data);
+    free(gd->screens);
+    gd->screens = NULL;
+}
+
 int main(int argc, char const *argv[])
 {
-    int nvscreen;
     Display *dpy;
 
+    vhook_install_error_handler();
+
+    /* Headless mode, serving one or more X displays without a GUI */
+    if (argc > 1 && !strcmp(argv[1], "--daemon"))
+        return vib_daemon_main(argc, (char **)argv);
+
+    /* Apply settings once and exit, without the GUI nor the event loop */
+    if (argc > 1 && !strcmp(argv[1], "--apply"))
+        return vib_apply_main(argc, (char **)argv);
+
     /* NULL gets the display based on the
         envvar $DISPLAY name */
     dpy = XOpenDisplay(NULL);
@@ -173,8 +406,11 @@ int main(int argc, char const *argv[])
     gdisplay.dpy = dpy;
 
     pthread_spin_init(&gdisplay.lock, PTHREAD_PROCESS_PRIVATE);
-    nvscreen = GetNvXScreen(gdisplay.dpy);
-    device_display_config_init(nvscreen);
+    gdisplay.wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (gdisplay.wakefd < 0)
+        DIE("eventfd");
+    if (device_display_config_init(&gdisplay))
+        DIE("Unable to find any NVIDIA X screens; aborting.\n");
     do_init_gtk_window(argc, argv);
     pthread_spin_destroy(&gdisplay.lock);
 